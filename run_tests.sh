@@ -20,13 +20,14 @@ TESTDIR="./tests"
 OUTPUTDIR="./output"
 EXPECTEDDIR="./tests/expected"
 INPUTSDIR="./tests/inputs"
+SCRIPTSDIR="./tests/scripts"
 PROGRAM_NAME="controller"
 
 # Run make clean and then make all.
 run_make () {
   local verbose=$1
   local moutput=""
-  local makeargs="LOG=1"
+  local makeargs="LOG=1 ${MAKEARGS}"
   make clean > /dev/null 2>&1
   printf "${GREEN}Running ${BOLD}%-24s${NONE} " "make all:"
   moutput=$(make ${makeargs} all 2>&1)
@@ -72,6 +73,8 @@ run_test () {
   # -t input1,input2,...   list of input files containing requests to be sent to the controller
   # -c                     specifies to send each request file's requests concurrently (default is sequential)
   # -e expected            path to file with expected result
+  # -s script              script in tests/scripts run once the requests are answered, given the port and
+  #                        the test's output directory; what it prints is appended to the responses
   # -- ...                 arguments after the '--' are used as the args of the controller
 
   local num_nodes=0
@@ -79,11 +82,12 @@ run_test () {
   local concurrent=0
   local port_num="1024" # default port is 1024
   local expected=""
+  local script=""
   local controller_args=""
 
   local args=`cat $test_file`
 
-  options=`getopt t:p:ce: $args`
+  options=`getopt t:p:ce:s: $args`
   errcode=$?
   if [ ${errcode} -ne 0 ]; then 
     echo "illegal test configuration; aborting"
@@ -103,6 +107,7 @@ run_test () {
       -p) port_num=$2; shift; shift;;
       -c) concurrent=1; shift;;
       -e) expected=$EXPECTEDDIR/$2; shift; shift;;
+      -s) script=$SCRIPTSDIR/$2; shift; shift;;
       --)
         shift;
         controller_args="$*"
@@ -110,7 +115,9 @@ run_test () {
     esac
   done
 
-  controller_args="-p ${port_num} ${controller_args}"
+  local ready_file=$OUTPUTDIR/ready
+  rm -f ${ready_file}
+  controller_args="-p ${port_num} -R ${ready_file} ${controller_args}"
 
   if [[ ${#req_files[@]} -eq 0 ]]; then
     echo "Illegal test configuration; aborting"
@@ -135,7 +142,7 @@ run_test () {
 
   for i in `seq 0 $((${#req_files[@]}-1))`; do
     if [ $concurrent -eq 1 ]; then
-      ${TIMEOUT} ./send_requests.sh ${req_files[i]} ${port_num} $OUTPUTDIR/response$i &
+      ${TIMEOUT} ./send_requests.sh ${req_files[i]} ${port_num} $OUTPUTDIR/response$i ${ready_file} &
       pids[i]=$!
       req_ret="$?"
       if [ "${req_ret}" == "124" ]; then # timed out
@@ -144,7 +151,7 @@ run_test () {
         req_err=1
       fi
     else
-      ${TIMEOUT} ./send_requests.sh ${req_files[i]} ${port_num} $OUTPUTDIR/response$i
+      ${TIMEOUT} ./send_requests.sh ${req_files[i]} ${port_num} $OUTPUTDIR/response$i ${ready_file}
       req_ret="$?"
       if [ "${req_ret}" == "124" ]; then # timed out
         tmr_err=1
@@ -172,6 +179,14 @@ run_test () {
     cat $OUTPUTDIR/response$i >> $OUTPUTDIR/response
   done
 
+  # -------------------------------- Run the script --------------------------------
+  if [ "${script}" != "" ]; then
+    ${TIMEOUT} ${script} ${port_num} $OUTPUTDIR >> $OUTPUTDIR/response 2>&1
+    if [ "$?" == "124" ]; then
+      tmr_err=1
+    fi
+  fi
+
   output=$OUTPUTDIR/response
 
   # ----------------------- Check Responses From Server ------------------------
@@ -269,7 +284,8 @@ else
   BASIC_TESTS="basic-1 basic-2 basic-3 basic-4 basic-5 basic-6"
   MULTI_TESTS="multi-1 multi-2"
   CONC_TESTS="concurrent-1 concurrent-2 concurrent-3"
-  ALL_TESTS="${BASIC_TESTS} ${MULTI_TESTS} ${CONC_TESTS}"
+  EXT_TESTS="shm-1 splice-1 deadline-1 busy-1 lanes-1 gates-free-1 dump-1 watch-1 watch-2 lifecycle-1 host-1 host-2 lazy-1 affinity-1 frontends-1 replica-1 workers-1 trace-1 trace-2 combine-1 cache-1 cache-2 cache-3 range-1 pool-1 pool-2 optimize-1 stress-1"
+  ALL_TESTS="${BASIC_TESTS} ${MULTI_TESTS} ${CONC_TESTS} ${EXT_TESTS}"
 fi
 
 # Timeout
@@ -5,6 +5,7 @@
 testfile=$1
 port=$2 
 outfile=$3
+readyfile=$4 # created by the controller (-R) once every airport is up
 NC_FLAGS="-N"
 retcode=0
 
@@ -16,10 +17,14 @@ fi
 rm -f ${outfile}
 touch ${outfile}
 
-while : ; do 
-  nc -z localhost $port >/dev/null 2>&1
-  if [ $? -eq 0 ]; then break ; fi 
-done
+if [ -n "${readyfile}" ]; then
+  while [ ! -e ${readyfile} ]; do sleep 0.01; done
+else
+  while : ; do 
+    nc -z localhost $port >/dev/null 2>&1
+    if [ $? -eq 0 ]; then break ; fi 
+  done
+fi
 
 cat ${testfile} | nc ${NC_FLAGS} localhost $port >> ${outfile} 2>&1
 
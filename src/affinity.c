@@ -0,0 +1,137 @@
+/* Needs _GNU_SOURCE for cpu_set_t and sched_setaffinity(). */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "affinity.h"
+
+// the usable CPUs of one NUMA node, in increasing order
+typedef struct {
+  int num_cpus;
+  int cpus[CPU_SETSIZE];
+} cpu_group_t;
+
+static cpu_group_t *GROUPS;
+static int NUM_GROUPS;
+
+/* Parses a list like "0-3,8,10-11" into `set`. Returns -1 if it's malformed. */
+static int parse_cpu_list(const char *list, cpu_set_t *set) {
+  const char *p = list;
+  CPU_ZERO(set);
+  while (*p && *p != '\n') {
+    char *end;
+    long first = strtol(p, &end, 10), last = first;
+    if (end == p)
+      return -1;
+    p = end;
+    if (*p == '-') {
+      last = strtol(++p, &end, 10);
+      if (end == p)
+        return -1;
+      p = end;
+    }
+    if (first < 0 || last < first || last >= CPU_SETSIZE)
+      return -1;
+    for (long cpu = first; cpu <= last; cpu++)
+      CPU_SET((size_t)cpu, set);
+    if (*p == ',')
+      p++;
+    else if (*p && *p != '\n')
+      return -1;
+  }
+  return 0;
+}
+
+/* Moves the CPUs of `node` that are in `allowed` into a new group, taking
+ * them out of `allowed`. */
+static void add_group(cpu_set_t *node, cpu_set_t *allowed) {
+  cpu_group_t *group = &GROUPS[NUM_GROUPS];
+  group->num_cpus = 0;
+  for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, node) && CPU_ISSET(cpu, allowed)) {
+      group->cpus[group->num_cpus++] = (int)cpu;
+      CPU_CLR(cpu, allowed);
+    }
+  }
+  if (group->num_cpus > 0)
+    NUM_GROUPS++;
+}
+
+int affinity_init(const char *list) {
+  cpu_set_t allowed, usable, node;
+  char path[64], buf[4096];
+
+  // CPUs outside our own mask (offline, or taken away by a cpuset) can't be
+  // pinned to
+  if (sched_getaffinity(0, sizeof(usable), &usable) < 0)
+    return -1;
+  if (!strcmp(list, "all"))
+    allowed = usable;
+  else if (parse_cpu_list(list, &allowed) < 0)
+    return -1;
+  CPU_AND(&allowed, &allowed, &usable);
+  // one more group than there are nodes, for CPUs no node claimed
+  if ((GROUPS = calloc(AFFINITY_MAX_NODES + 1, sizeof(cpu_group_t))) == NULL)
+    return -1;
+
+  for (int n = 0; n < AFFINITY_MAX_NODES; n++) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+    FILE *f = fopen(path, "r");
+    if (!f)
+      continue;
+    int ok = fgets(buf, sizeof(buf), f) && parse_cpu_list(buf, &node) == 0;
+    fclose(f);
+    if (ok)
+      add_group(&node, &allowed);
+  }
+  // no NUMA information (or CPUs it didn't mention): treat them as one node
+  CPU_ZERO(&node);
+  for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    CPU_SET(cpu, &node);
+  add_group(&node, &allowed);
+
+  if (NUM_GROUPS == 0) {
+    free(GROUPS);
+    GROUPS = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+int affinity_pin(int slot, int num_slots) {
+  cpu_set_t set;
+  if (!GROUPS || num_slots <= 0)
+    return -1;
+  slot %= num_slots;
+
+  // slots s with s * NUM_GROUPS / num_slots == g go to group g
+  int g = (int)((long)slot * NUM_GROUPS / num_slots);
+  int first = (int)(((long)g * num_slots + NUM_GROUPS - 1) / NUM_GROUPS);
+  int next = (int)(((long)(g + 1) * num_slots + NUM_GROUPS - 1) / NUM_GROUPS);
+  int local = slot - first, shared = next - first;
+  cpu_group_t *group = &GROUPS[g];
+
+  // an even share of the group's CPUs, or one of them if there are more
+  // slots than CPUs
+  int start = local * group->num_cpus / shared;
+  int end = (local + 1) * group->num_cpus / shared;
+  if (end <= start)
+    end = start + 1;
+
+  CPU_ZERO(&set);
+  for (int i = start; i < end; i++)
+    CPU_SET((size_t)group->cpus[i], &set);
+  if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+    perror("sched_setaffinity");
+    return -1;
+  }
+  return group->cpus[start];
+}
+
+void affinity_steer(int listenfd, int cpu) {
+  if (cpu >= 0 && setsockopt(listenfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0)
+    perror("setsockopt(SO_INCOMING_CPU)");
+}
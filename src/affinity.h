@@ -0,0 +1,44 @@
+#ifndef AFFINITY_HEADER
+#define AFFINITY_HEADER
+
+/** CPU and NUMA placement for airport nodes (`-a`).
+ *
+ *  The CPUs we're allowed to use are grouped by the NUMA node they belong to
+ *  (read from `/sys/devices/system/node`). Each process that serves airports
+ *  is given a slot, and slots are spread over the NUMA nodes in contiguous
+ *  runs, so neighbouring airports share a socket, then the CPUs of a NUMA node
+ *  are split between the slots placed on it.
+ *
+ *  A process pins itself before it allocates any airport state. Its worker
+ *  threads inherit the mask, and since Linux places a page on the node of the
+ *  CPU that first touches it, its gates end up in local memory without any
+ *  explicit NUMA calls.
+ */
+
+#define AFFINITY_MAX_NODES 64 /* NUMA nodes looked at */
+
+/** @brief Sets up the CPUs placement may use.
+ *
+ *  @param list A CPU list as in `/sys` ("0-3,8,10-11"), or "all" for every
+ *              CPU this process may currently run on.
+ *
+ *  @returns 0 on success, or -1 if `list` is malformed or names no CPU we can
+ *           use.
+ */
+int affinity_init(const char *list);
+
+/** @brief Pins the calling process to the CPUs of slot `slot` out of
+ *         `num_slots`. Slots past the end wrap around.
+ *
+ *  @returns The first CPU of the set, or -1 if placement isn't enabled or the
+ *           mask couldn't be applied.
+ */
+int affinity_pin(int slot, int num_slots);
+
+/** @brief Asks the kernel to prefer `listenfd` for connections arriving on
+ *         `cpu` (`SO_INCOMING_CPU`). Only matters when several sockets listen
+ *         on the same port.
+ */
+void affinity_steer(int listenfd, int cpu);
+
+#endif
@@ -1,15 +1,29 @@
 #include "airport.h"
+#include "change_log.h"
+#include "format.h"
 #include "network_utils.h"
+#include "occupancy.h"
+#include "shm_ring.h"
+#ifdef USE_IO_URING
+#include "uring_io.h"
+#endif
 #include <bits/pthreadtypes.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
+/* Workers a node may grow to by default, even on machines with fewer CPUs. */
 #define MAX_THREADS 4
-#define MAX_QUEUE 16
 
 /** This is the main file in which you should implement the airport server code.
  *  There are many functions here which are pre-written for you. You should read
@@ -22,70 +36,459 @@
  *  functions you have been given if needed.
  */
 
-/* This will be set by the `initialise_node` function. */
-static int AIRPORT_ID = -1;
+/* A SCHEDULE waiting for the combiner to place it (see `combine_schedule`). */
+typedef struct schedule_intent_t {
+  int plane_id, start, duration, fuel;
+  time_info_t result;
+  int done; /* set by the combiner once `result` is filled in */
+  struct schedule_intent_t *next;
+} schedule_intent_t;
 
-/* This will be set by the `initialise_node` function. */
-static airport_t *AIRPORT_DATA = NULL;
+/* Publication list of SCHEDULEs for one airport, in the order they came in. */
+typedef struct {
+  pthread_mutex_t lock; /* guards everything here */
+  pthread_cond_t done;  /* a batch has been placed */
+  schedule_intent_t *head, **tail;
+  int combining;        /* 1 while some thread is placing a batch */
+} combiner_t;
+
+/* Everything a node keeps for one of the airports it hosts. */
+typedef struct {
+  int id;
+  airport_t *data;
+  change_log_t changes; /* Every placement made here, for WATCH subscribers */
+  combiner_t combiner;  /* SCHEDULEs waiting to be placed, with -b */
+  atomic_int retiring;  /* Set once RETIRE has been received */
+  atomic_int retired;   /* Set once RETIRE has been answered */
+  int queued;    /* Requests for it waiting for a worker, under the queue lock */
+  int in_flight; /* and being worked on */
+} hosted_airport_t;
+
+/* The airports `FIRST_HOSTED`..`FIRST_HOSTED + NUM_HOSTED - 1` served by this
+ * node, set up by `initialise_host`. Usually there's just the one. */
+static hosted_airport_t *HOSTED = NULL;
+static int FIRST_HOSTED = 0, NUM_HOSTED = 0;
+/* The node exits once every airport it hosts has been retired. */
+static atomic_int NUM_RETIRED;
+/* Set in a read-only replica, whose airport only changes when its primary's
+ * does (see `initialise_replica`). */
+static int READ_ONLY = 0;
+
+/* The airport the current thread is working for, see `use_airport`. */
+static __thread hosted_airport_t *CURRENT = NULL;
+static __thread int AIRPORT_ID = -1;
+static __thread airport_t *AIRPORT_DATA = NULL;
+
+/* Set by the controller before the airport nodes are forked. */
+airport_config_t AIRPORT_CONFIG = {MAX_QUEUE, 0, DEFAULT_URGENT_FUEL, 1, 0, 0, 0, -1};
+
+/* Requests are served from one of these lanes, most important first. */
+#define LANE_URGENT 0   /* SCHEDULE for a plane that is low on fuel */
+#define LANE_MUTATION 1 /* any other SCHEDULE */
+#define LANE_QUERY 2    /* read-only requests (and anything unrecognised) */
+#define NUM_LANES 3
 
-// create structure in this file just for queing connections
+/* A request that has waited this long is served before newer requests in
+ * more important lanes, so a burst of schedules can't starve the queries. */
+#define STARVATION_MS 20
+
+/* How long the accept thread waits for a request line to arrive, and how many
+ * connections it waits on at once. */
+#define REQUEST_READ_TIMEOUT_MS 1000
+#define MAX_PENDING_READS 64
+
+/* A watcher that hears nothing for this long checks its client is still
+ * there, and one whose client won't take an event for this long is dropped. */
+#define WATCH_IDLE_MS 1000
+#define WATCH_SEND_TIMEOUT_MS 5000
+/* Changes a watcher takes off the log at once. */
+#define WATCH_BATCH 32
+
+/* DUMP (and TIME_RANGE) replies are sent in pieces of this size, and one text
+ * record never takes more than `DUMP_MAX_RECORD` bytes of it. */
+#define DUMP_CHUNK 4096
+#define DUMP_MAX_RECORD 48
+
+/* How long a replica waits for its primary to let it back in after losing
+ * its stream. */
+#define REPLICA_CONNECT_TIMEOUT_MS 1000
+
+/* A worker builds its whole reply before writing it, in a buffer that holds a
+ * whole-day TIME_STATUS. A reply line only ever echoes part of a request, so
+ * it's never longer than REPLY_LINE_MAX. */
+#define REPLY_BUFSIZE 2048
+#define REPLY_LINE_MAX (REQUEST_MAX + 64)
+
+// a request waiting for a worker, and when it turned up
 typedef struct {
-  int buf[MAX_QUEUE];
-  int head;
-  int tail;
-  int len;
+  int connfd;
+  int lane;
+  hosted_airport_t *airport; // NULL if it isn't for one of ours
+  long arrival_ms;
+  char line[REQUEST_MAX];
+} conn_item_t;
+
+// create structure in this file just for queing connections, one ring per lane
+typedef struct {
+  conn_item_t buf[NUM_LANES][MAX_QUEUE];
+  int head[NUM_LANES];
+  int tail[NUM_LANES];
+  int len[NUM_LANES];
+  int total; // requests waiting across all lanes
+  int workers; // worker threads running (or being started)
+  int idle;    // workers waiting for a request
   pthread_mutex_t mutex;
   pthread_cond_t cond_notempty;
-  pthread_cond_t cond_notfull;
+  pthread_cond_t cond_idle; // a worker finished a request
 } conn_queue_t;
 
 static conn_queue_t conn_queue;
 
+// what a WATCH subscriber wants to hear about, -1 meaning anything
+typedef struct {
+  hosted_airport_t *airport;
+  int connfd;
+  int gate;
+  int plane_id;
+} watch_t;
+
+/* A worker's reply buffer. They're carved out of a fixed slab per node and
+ * handed back when a worker exits, so workers started later reuse them
+ * rather than allocating, and there are never more than MAX_WORKERS. */
+typedef struct conn_ctx {
+  char out[REPLY_BUFSIZE];
+  size_t len;
+  struct conn_ctx *next; // in the free list
+} conn_ctx_t;
+
+static struct {
+  pthread_mutex_t lock;
+  conn_ctx_t *free;
+  int carved; // slab entries handed out at least once
+  conn_ctx_t slab[MAX_WORKERS];
+} CTX_POOL = {PTHREAD_MUTEX_INITIALIZER, NULL, 0};
+
+/* Takes a context from the pool, or returns NULL if they're all in use. */
+static conn_ctx_t *ctx_take(void) {
+  conn_ctx_t *ctx = NULL;
+  pthread_mutex_lock(&CTX_POOL.lock);
+  if (CTX_POOL.free) {
+    ctx = CTX_POOL.free;
+    CTX_POOL.free = ctx->next;
+  } else if (CTX_POOL.carved < MAX_WORKERS) {
+    ctx = &CTX_POOL.slab[CTX_POOL.carved++];
+  }
+  pthread_mutex_unlock(&CTX_POOL.lock);
+  if (ctx)
+    ctx->len = 0;
+  return ctx;
+}
+
+static void ctx_give(conn_ctx_t *ctx) {
+  if (!ctx)
+    return;
+  pthread_mutex_lock(&CTX_POOL.lock);
+  ctx->next = CTX_POOL.free;
+  CTX_POOL.free = ctx;
+  pthread_mutex_unlock(&CTX_POOL.lock);
+}
+
+/* Where the lines of a response go: straight to a socket, or into the
+ * response ring of a shared-memory channel. With a context they're collected
+ * there first and only written by `reply_flush` (or when it fills up). */
+typedef struct {
+  int connfd;
+  shm_ring_t *ring;
+  conn_ctx_t *ctx;
+} reply_t;
+
+static void reply_write(reply_t *out, char *response, size_t n) {
+  if (out->ring)
+    shm_ring_write(out->ring, response, n, 0, -1);
+  else
+    rio_writen(out->connfd, response, n);
+}
+
+static void reply_flush(reply_t *out) {
+  if (out->ctx && out->ctx->len > 0) {
+    reply_write(out, out->ctx->out, out->ctx->len);
+    out->ctx->len = 0;
+  }
+}
+
+static void reply_raw(reply_t *out, char *response, size_t n) {
+  conn_ctx_t *ctx = out->ctx;
+  if (!ctx) {
+    reply_write(out, response, n);
+    return;
+  }
+  if (ctx->len + n > sizeof(ctx->out)) {
+    reply_flush(out);
+    // DUMP and TIME_RANGE send bigger pieces than the buffer, as they are
+    if (n > sizeof(ctx->out)) {
+      reply_write(out, response, n);
+      return;
+    }
+  }
+  memcpy(ctx->out + ctx->len, response, n);
+  ctx->len += n;
+}
+
+static void reply(reply_t *out, const char *format, ...) {
+  conn_ctx_t *ctx = out->ctx;
+  char response[REPLY_LINE_MAX];
+  va_list args;
+  va_start(args, format);
+  if (ctx) {
+    // formatted straight into the buffer
+    if (sizeof(ctx->out) - ctx->len < REPLY_LINE_MAX)
+      reply_flush(out);
+    int n = vsnprintf(ctx->out + ctx->len, REPLY_LINE_MAX, format, args);
+    ctx->len += n < REPLY_LINE_MAX ? (size_t)n : REPLY_LINE_MAX - 1;
+  } else {
+    vsnprintf(response, sizeof(response), format, args);
+    reply_write(out, response, strlen(response));
+  }
+  va_end(args);
+}
+
+/* Room for a line of up to REPLY_LINE_MAX bytes, to be built with the
+ * format.h helpers and sent with `reply_commit`: in the context's buffer when
+ * there is one, so it never has to be copied, otherwise in `scratch`. */
+static char *reply_reserve(reply_t *out, char *scratch) {
+  conn_ctx_t *ctx = out->ctx;
+  if (!ctx)
+    return scratch;
+  if (sizeof(ctx->out) - ctx->len < REPLY_LINE_MAX)
+    reply_flush(out);
+  return ctx->out + ctx->len;
+}
+
+static void reply_commit(reply_t *out, char *line, char *end) {
+  if (out->ctx)
+    out->ctx->len += (size_t)(end - line);
+  else
+    reply_write(out, line, (size_t)(end - line));
+}
+
+static long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 void queue_init(conn_queue_t *p) {
-  p->head = 0;
-  p->tail = -1;
-  p->len = 0;
+  for (int lane = 0; lane < NUM_LANES; lane++) {
+    p->head[lane] = 0;
+    p->tail[lane] = -1;
+    p->len[lane] = 0;
+  }
+  p->total = 0;
+  p->workers = 0;
+  p->idle = 0;
   pthread_mutex_init(&p->mutex, NULL);
-  pthread_cond_init(&p->cond_notempty, NULL);
-  pthread_cond_init(&p->cond_notfull, NULL);
+  // idle workers time out, and that shouldn't depend on the wall clock
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&p->cond_notempty, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&p->cond_idle, NULL);
 }
 
-// queuer function
+static int start_worker(conn_queue_t *p);
 
-void queue_please(conn_queue_t *p, int connfd) {
+// queuer function, never blocks: returns -1 if the queue is over the watermark
+int queue_please(conn_queue_t *p, conn_item_t *item) {
+  int grow = 0;
   pthread_mutex_lock(&p->mutex);
-  while (p->len == MAX_QUEUE) {
-    pthread_cond_wait(&p->cond_notfull, &p->mutex);
+  if (p->total >= AIRPORT_CONFIG.queue_watermark || p->total == MAX_QUEUE) {
+    pthread_mutex_unlock(&p->mutex);
+    return -1;
+  }
+  int lane = item->lane;
+  p->tail[lane] = (p->tail[lane] + 1) % MAX_QUEUE;
+  p->buf[lane][p->tail[lane]] = *item;
+  p->len[lane]++;
+  p->total++;
+  if (item->airport) {
+    item->airport->queued++;
+    // it got in just ahead of a RETIRE, which has to wait for it (or serve it)
+    if (atomic_load(&item->airport->retiring))
+      pthread_cond_broadcast(&p->cond_idle);
+  }
+  // more waiting than there are workers free to take them, and the rest are
+  // busy (or stuck behind a gate lock or a slow client): add one
+  if (p->total > p->idle && p->workers < AIRPORT_CONFIG.max_workers) {
+    p->workers++;
+    grow = 1;
   }
-  p->tail = (p->tail + 1) % MAX_QUEUE;
-  p->buf[p->tail] = connfd;
-  p->len++;
   pthread_cond_signal(&p->cond_notempty);
   pthread_mutex_unlock(&p->mutex);
+  if (grow)
+    start_worker(p);
+  return 0;
+}
+
+/* Picks the lane to serve next: the most important non-empty lane, unless a
+ * less important one has a request that has been waiting too long. */
+static int pick_lane(conn_queue_t *p) {
+  int best = -1, oldest = -1;
+  long oldest_arrival = 0, now = now_ms();
+  for (int lane = 0; lane < NUM_LANES; lane++) {
+    if (p->len[lane] == 0)
+      continue;
+    long arrival = p->buf[lane][p->head[lane]].arrival_ms;
+    if (best < 0)
+      best = lane;
+    if (now - arrival >= STARVATION_MS && (oldest < 0 || arrival < oldest_arrival)) {
+      oldest = lane;
+      oldest_arrival = arrival;
+    }
+  }
+  return oldest >= 0 ? oldest : best;
+}
+
+static void idle_deadline(struct timespec *deadline) {
+  clock_gettime(CLOCK_MONOTONIC, deadline);
+  deadline->tv_sec += WORKER_IDLE_MS / 1000;
+  deadline->tv_nsec += (WORKER_IDLE_MS % 1000) * 1000000L;
+  if (deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000L;
+  }
 }
 
+/* Takes the next request off the queue, which holds at least one. Called
+ * with the queue lock held. */
+static void take_item(conn_queue_t *p, conn_item_t *item) {
+  int lane = pick_lane(p);
+  *item = p->buf[lane][p->head[lane]]; // dequeue the first one in that lane
+  p->head[lane] = (p->head[lane] + 1) % MAX_QUEUE;
+  p->len[lane]--;
+  p->total--;
+  if (item->airport) {
+    item->airport->queued--;
+    item->airport->in_flight++;
+  }
+}
 
-// de-queuer function use threads or something.
-int dequeue_please(conn_queue_t *p) {
-  int connfd; 
+// de-queuer function use threads or something. Returns -1 when the calling
+// worker has been idle long enough to exit (it's no longer counted by then)
+int dequeue_please(conn_queue_t *p, conn_item_t *item) {
+  struct timespec deadline;
+  idle_deadline(&deadline);
   pthread_mutex_lock(&p->mutex);
-  while (p->len == 0) {
-    pthread_cond_wait(&p->cond_notempty, &p->mutex);
+  while (p->total == 0) {
+    p->idle++;
+    int rc = pthread_cond_timedwait(&p->cond_notempty, &p->mutex, &deadline);
+    p->idle--;
+    if (rc == ETIMEDOUT && p->total == 0 && p->workers > AIRPORT_CONFIG.min_workers) {
+      p->workers--;
+      pthread_mutex_unlock(&p->mutex);
+      return -1;
+    }
+    if (rc == ETIMEDOUT) // one of the ones we keep, wait another round
+      idle_deadline(&deadline);
   }
-  connfd = p->buf[p->head]; // dequeue the first one
-  p->head = (p->head + 1) % MAX_QUEUE;
-  p->len--;
-  pthread_cond_signal(&p->cond_notfull);
+  take_item(p, item);
   pthread_mutex_unlock(&p->mutex);
-  return connfd;
+  return 0;
 }
 
+void request_done(conn_queue_t *p, conn_item_t *item) {
+  pthread_mutex_lock(&p->mutex);
+  if (item->airport)
+    item->airport->in_flight--;
+  pthread_cond_broadcast(&p->cond_idle);
+  pthread_mutex_unlock(&p->mutex);
+}
+
+void process_commands(conn_item_t *item, conn_ctx_t *ctx);
+
+/* Waits until the only request left for `airport` is the caller's own. A host
+ * shares the queue between its airports, and only this one's requests count:
+ * RETIREs for two of them would otherwise each wait for the other to finish.
+ * Whatever is queued meanwhile the caller serves itself, with its own reply
+ * buffer (nothing is in it yet), since there may be no other worker to. */
+static void wait_for_drain(conn_queue_t *p, hosted_airport_t *airport, conn_ctx_t *ctx) {
+  conn_item_t item;
+  pthread_mutex_lock(&p->mutex);
+  while (airport->queued > 0 || airport->in_flight > 1) {
+    if (p->total == 0) {
+      pthread_cond_wait(&p->cond_idle, &p->mutex);
+      continue;
+    }
+    take_item(p, &item);
+    pthread_mutex_unlock(&p->mutex);
+    process_commands(&item, ctx);
+    request_done(p, &item);
+    pthread_mutex_lock(&p->mutex);
+  }
+  pthread_mutex_unlock(&p->mutex);
+}
+
+/* Works out which lane a request line belongs in. */
+static int classify_request(char *line) {
+  char command[REQUEST_MAX];
+  int airport_num, plane_id, earliest_time, duration, fuel;
+  if (sscanf(line, "%s", command) != 1 || strcmp(command, "SCHEDULE") != 0)
+    return LANE_QUERY;
+  if (sscanf(line, "%s %d %d %d %d %d", command, &airport_num, &plane_id,
+             &earliest_time, &duration, &fuel) == 6 &&
+      fuel <= AIRPORT_CONFIG.urgent_fuel)
+    return LANE_URGENT;
+  return LANE_MUTATION;
+}
+
+/* Returns the deadline (in ms after arrival) of a request: the value of a
+ * trailing `DEADLINE <ms>` pair if it has one, otherwise the default. The pair
+ * is cut out of the request, so handlers never take it for an argument. Only
+ * the read cache's `CACHED <version>` may come after it. A DEADLINE anywhere
+ * else, or without a positive value, makes it -1. */
+static int take_deadline(char *buf) {
+  char *end = buf + strcspn(buf, "\r\n"), *token, *cached;
+  int deadline_ms, n;
+  if (AIRPORT_CONFIG.read_cache && (cached = strstr(buf, " CACHED ")) != NULL)
+    end = cached;
+  if ((token = strstr(buf, " DEADLINE")) == NULL || token >= end)
+    return AIRPORT_CONFIG.default_deadline_ms;
+  if (sscanf(token, " DEADLINE %d%n", &deadline_ms, &n) != 1 || token + n != end ||
+      deadline_ms <= 0)
+    return -1;
+  memmove(token, end, strlen(end) + 1);
+  return deadline_ms;
+}
+
+
+/* Number of gates that are safe to use right now (more may be on the way). */
+static int airport_num_gates(void) {
+  return __atomic_load_n(&AIRPORT_DATA->num_gates, __ATOMIC_ACQUIRE);
+}
+
+/* The airport's layout sequence number is to OPTIMIZE what a gate's `seq` is
+ * to a placement: it's odd while planes are being moved between gates, which
+ * only happens with every gate lock held. Anything that looks at more than one
+ * gate without holding all their locks takes the number before it starts and
+ * starts over if `layout_changed` says it moved. */
+static unsigned layout_begin(void) {
+  unsigned seq;
+  while ((seq = __atomic_load_n(&AIRPORT_DATA->layout_seq, __ATOMIC_ACQUIRE)) & 1)
+    sched_yield();
+  return seq;
+}
+
+static int layout_changed(unsigned seq) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&AIRPORT_DATA->layout_seq, __ATOMIC_RELAXED) != seq;
+}
 
 gate_t *get_gate_by_idx(int gate_idx) {
-  if ((gate_idx) < 0 || (gate_idx > AIRPORT_DATA->num_gates))
+  if ((gate_idx) < 0 || (gate_idx >= airport_num_gates()))
     return NULL;
   else
-    return &AIRPORT_DATA->gates[gate_idx];
+    return &AIRPORT_DATA->segments[gate_idx / GATE_SEGMENT_SIZE]
+                ->gates[gate_idx % GATE_SEGMENT_SIZE];
 }
 
 time_slot_t *get_time_slot_by_idx(gate_t *gate, int slot_idx) {
@@ -119,11 +522,24 @@ int set_time_slot(time_slot_t *ts, int plane_id, int start_idx, int end_idx) {
 int add_plane_to_slots(gate_t *gate, int plane_id, int start, int count) {
   int ret = 0, end = start + count;
   time_slot_t *ts = NULL;
+  uint64_t *occ = &AIRPORT_DATA->segments[gate->index / GATE_SEGMENT_SIZE]
+                       ->occupancy[gate->index % GATE_SEGMENT_SIZE];
+  // TIME_RANGE copies the slots without the lock and tries again if this
+  // moved while it was copying
+  __atomic_store_n(&gate->seq, gate->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
   for (int idx = start; idx <= end; idx++) {
     ts = get_time_slot_by_idx(gate, idx);
     ret = set_time_slot(ts, plane_id, start, end);
     if (ret < 0) break;
+    // GATES_FREE reads these without taking the gate lock
+    __atomic_fetch_or(occ, (uint64_t)1 << idx, __ATOMIC_RELEASE);
   }
+  __atomic_store_n(&gate->seq, gate->seq + 1, __ATOMIC_RELEASE);
+  // both count placements rather than requests, so a replica holding the same
+  // placements has the same versions as its primary
+  gate->version++;
+  __atomic_fetch_add(&AIRPORT_DATA->version, 1, __ATOMIC_RELEASE);
   return ret;
 }
 
@@ -149,82 +565,497 @@ int search_gate(gate_t *gate, int plane_id) {
 
 
 time_info_t lookup_plane_in_airport(int plane_id) {
-  time_info_t result = {-1, -1, -1};
+  time_info_t result;
   int gate_idx, slot_idx;
+  unsigned layout;
   gate_t *gate;
-  for (gate_idx = 0; gate_idx < AIRPORT_DATA->num_gates; gate_idx++) {
-    gate = get_gate_by_idx(gate_idx);
-    if ((slot_idx = search_gate(gate, plane_id)) >= 0) {
-      result.start_time = slot_idx;
-      result.gate_number = gate_idx;
-    time_slot_t *t = get_time_slot_by_idx(gate, slot_idx);
-      result.end_time = t->end_time;
-      break;
+  // a plane OPTIMIZE moved to a gate we'd already looked at would be missed
+  do {
+    result = (time_info_t){-1, -1, -1};
+    layout = layout_begin();
+    for (gate_idx = 0; gate_idx < airport_num_gates(); gate_idx++) {
+      gate = get_gate_by_idx(gate_idx);
+      if ((slot_idx = search_gate(gate, plane_id)) >= 0) {
+        result.start_time = slot_idx;
+        result.gate_number = gate_idx;
+      time_slot_t *t = get_time_slot_by_idx(gate, slot_idx);
+        result.end_time = t->end_time;
+        break;
+      }
     }
-  }
+  } while (layout_changed(layout));
   return result;
 }
 
-// it cires and then does mutex stuff
-int assign_in_gate(gate_t *gate, int plane_id, int start, int duration, int fuel) {
+/* assign_in_gate for a caller that already holds the gate lock. */
+static int assign_in_locked_gate(gate_t *gate, int plane_id, int start, int duration, int fuel) {
   int idx, end;
   int latest_start = start + fuel;
-  if (latest_start >= NUM_TIME_SLOTS)
-    latest_start = NUM_TIME_SLOTS - duration;
-  pthread_mutex_lock(&gate->lock);
+  // the plane takes slots idx..idx + duration, so that's what has to be free
+  if (latest_start + duration >= NUM_TIME_SLOTS)
+    latest_start = NUM_TIME_SLOTS - 1 - duration;
   for (idx = start; idx <= latest_start; idx++) {
-    end = idx + duration - 1;
-    if (end >= NUM_TIME_SLOTS)
-      break;
+    end = idx + duration;
     if (check_time_slots_free(gate, idx, end)) {
       add_plane_to_slots(gate, plane_id, idx, duration); // make sure to use duration instead of end
-      pthread_mutex_unlock(&gate->lock);
+      // logged under the gate lock so changes to one gate stay in order
+      change_event_t ev = {0, CHANGE_SCHEDULED, gate->index, plane_id, idx, idx + duration};
+      change_log_append(&CURRENT->changes, &ev);
       return idx;
     }
   }
-  pthread_mutex_unlock(&gate->lock);
   return -1;
 }
 
+// it cires and then does mutex stuff
+int assign_in_gate(gate_t *gate, int plane_id, int start, int duration, int fuel) {
+  pthread_mutex_lock(&gate->lock);
+  int idx = assign_in_locked_gate(gate, plane_id, start, duration, fuel);
+  pthread_mutex_unlock(&gate->lock);
+  return idx;
+}
+
 
 time_info_t schedule_plane(int plane_id, int start, int duration, int fuel) {
   time_info_t result = {-1, -1, -1};
   gate_t *gate;
   int gate_idx, slot;
-  for (gate_idx = 0; gate_idx < AIRPORT_DATA->num_gates; gate_idx++) {
+  unsigned layout;
+again:
+  layout = layout_begin();
+  for (gate_idx = 0; gate_idx < airport_num_gates(); gate_idx++) {
     gate = get_gate_by_idx(gate_idx);
-    if ((slot = assign_in_gate(gate, plane_id, start, duration, fuel)) >= 0) {
+    pthread_mutex_lock(&gate->lock);
+    // OPTIMIZE may have made room at a gate we've already been turned away
+    // from. It can't be running while we hold a gate lock
+    if (layout_changed(layout)) {
+      pthread_mutex_unlock(&gate->lock);
+      goto again;
+    }
+    slot = assign_in_locked_gate(gate, plane_id, start, duration, fuel);
+    pthread_mutex_unlock(&gate->lock);
+    if (slot >= 0) {
       result.start_time = slot;
       result.gate_number = gate_idx;
       result.end_time = slot + duration;
-      break;
+      return result;
     }
   }
+  if (layout_changed(layout))
+    goto again;
+  return result;
+}
+
+static void combiner_init(combiner_t *c) {
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->done, NULL);
+  c->head = NULL;
+  c->tail = &c->head;
+  c->combining = 0;
+}
+
+/* Places a batch of intents gate by gate: each gate is locked once and every
+ * intent still unplaced tries it, in publication order. An intent only moves
+ * on to a gate once it has failed at every gate before it, and within a gate
+ * earlier intents go first, so each one ends up exactly where it would have
+ * if they had been scheduled one after the other. */
+static void place_batch(schedule_intent_t *batch) {
+  int left = 0;
+  for (schedule_intent_t *in = batch; in; in = in->next) {
+    in->result = (time_info_t){-1, -1, -1};
+    left++;
+  }
+  unsigned layout = layout_begin();
+  for (int gate_idx = 0; left > 0 && gate_idx < airport_num_gates(); gate_idx++) {
+    gate_t *gate = get_gate_by_idx(gate_idx);
+    pthread_mutex_lock(&gate->lock);
+    // the intents that are left go round again if OPTIMIZE ran, like
+    // schedule_plane. Those already placed were placed before it
+    if (layout_changed(layout)) {
+      pthread_mutex_unlock(&gate->lock);
+      layout = layout_begin();
+      gate_idx = -1;
+      continue;
+    }
+    for (schedule_intent_t *in = batch; in; in = in->next) {
+      if (in->result.start_time >= 0)
+        continue;
+      int slot = assign_in_locked_gate(gate, in->plane_id, in->start, in->duration, in->fuel);
+      if (slot >= 0) {
+        in->result.start_time = slot;
+        in->result.gate_number = gate_idx;
+        in->result.end_time = slot + in->duration;
+        left--;
+      }
+    }
+    pthread_mutex_unlock(&gate->lock);
+    if (left > 0 && gate_idx == airport_num_gates() - 1 && layout_changed(layout)) {
+      layout = layout_begin();
+      gate_idx = -1;
+    }
+  }
+}
+
+/* schedule_plane through the airport's combiner. The caller publishes its
+ * intent and then either waits for it to be placed or, if nobody is
+ * combining, takes the whole list and places it as one batch, over and over
+ * until its own intent is done. Under a burst that's one pass over the gates
+ * per batch instead of every worker queueing on gate 0, then gate 1, ... */
+static time_info_t combine_schedule(int plane_id, int start, int duration, int fuel) {
+  combiner_t *c = &CURRENT->combiner;
+  schedule_intent_t me = {plane_id, start, duration, fuel, {-1, -1, -1}, 0, NULL};
+
+  pthread_mutex_lock(&c->lock);
+  *c->tail = &me;
+  c->tail = &me.next;
+  while (!me.done) {
+    if (c->combining) {
+      pthread_cond_wait(&c->done, &c->lock);
+      continue;
+    }
+    schedule_intent_t *batch = c->head;
+    c->head = NULL;
+    c->tail = &c->head;
+    c->combining = 1;
+    pthread_mutex_unlock(&c->lock);
+
+    place_batch(batch);
+
+    pthread_mutex_lock(&c->lock);
+    // the intents live on their threads' stacks, which can't go away until
+    // we let go of the lock
+    for (schedule_intent_t *in = batch; in; in = in->next)
+      in->done = 1;
+    c->combining = 0;
+    pthread_cond_broadcast(&c->done);
+  }
+  time_info_t result = me.result;
+  pthread_mutex_unlock(&c->lock);
   return result;
 }
 
 airport_t *create_airport(int num_gates) {
   airport_t *data = NULL;
-  size_t memsize = 0;
   if (num_gates > 0) {
-    memsize = sizeof(airport_t) + (sizeof(gate_t) * (unsigned)num_gates);
-    data = calloc(1, memsize);
+    data = calloc(1, sizeof(airport_t));
   }
-  
+
   if (data) {
-    data->num_gates = num_gates;
-    for (int i = 0; i < num_gates; i++) {
-      pthread_mutex_init(&(data->gates[i].lock), NULL);
+    pthread_mutex_init(&data->grow_lock, NULL);
+    if (grow_airport(data, num_gates) < 0) {
+      free(data);
+      data = NULL;
     }
   }
   return data;
 }
 
+int grow_airport(airport_t *data, int count) {
+  pthread_mutex_lock(&data->grow_lock);
+  int old_gates = data->num_gates;
+  // checked before adding, a huge count would wrap around
+  if (count <= 0 || count > MAX_GATES - old_gates) {
+    pthread_mutex_unlock(&data->grow_lock);
+    return -1;
+  }
+  int new_gates = old_gates + count;
+  // new gates are set up completely before anyone can see them
+  for (int seg = old_gates / GATE_SEGMENT_SIZE; seg * GATE_SEGMENT_SIZE < new_gates; seg++) {
+    if (data->segments[seg])
+      continue;
+    gate_segment_t *segment = aligned_alloc(OCC_ALIGN, sizeof(gate_segment_t));
+    if (!segment) {
+      pthread_mutex_unlock(&data->grow_lock);
+      return -1;
+    }
+    memset(segment->occupancy, 0, sizeof(segment->occupancy));
+    __atomic_store_n(&data->segments[seg], segment, __ATOMIC_RELEASE);
+  }
+  // only the gates being added get touched, so a node hosting lots of small
+  // airports doesn't fault in a whole segment for each of them
+  for (int g = old_gates; g < new_gates; g++) {
+    gate_t *gate = &data->segments[g / GATE_SEGMENT_SIZE]->gates[g % GATE_SEGMENT_SIZE];
+    memset(gate, 0, sizeof(gate_t));
+    pthread_mutex_init(&gate->lock, NULL);
+    gate->index = g;
+  }
+  // and this is what makes the new gates visible
+  __atomic_store_n(&data->num_gates, new_gates, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&data->version, (unsigned long)count, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&data->grow_lock);
+  return new_gates;
+}
+
+/* Sets up the airports this node will serve. Exits the node if any of them
+ * can't be created. */
+static void create_hosted_airports(int first_airport, int num_airports, int *gate_counts) {
+  HOSTED = calloc((size_t)num_airports, sizeof(hosted_airport_t));
+  if (HOSTED == NULL)
+    exit(1);
+  FIRST_HOSTED = first_airport;
+  NUM_HOSTED = num_airports;
+  for (int i = 0; i < num_airports; i++) {
+    HOSTED[i].id = first_airport + i;
+    if ((HOSTED[i].data = create_airport(gate_counts[i])) == NULL)
+      exit(1);
+    change_log_init(&HOSTED[i].changes);
+    combiner_init(&HOSTED[i].combiner);
+  }
+}
+
+/* Tells the controller this node is up, if it's waiting to hear. */
+static void announce_ready(void) {
+  if (AIRPORT_CONFIG.ready_fd < 0)
+    return;
+  if (write(AIRPORT_CONFIG.ready_fd, "R", 1) < 0)
+    perror("[Airport] ready");
+  close(AIRPORT_CONFIG.ready_fd);
+  AIRPORT_CONFIG.ready_fd = -1;
+}
+
+/* Works out which hosted airport a request is for and makes it the calling
+ * thread's current airport. Returns NULL if it isn't one of ours. */
+static hosted_airport_t *use_airport(char *buf) {
+  hosted_airport_t *airport = &HOSTED[0];
+  int airport_num;
+  // a node with one airport answers everything, like it always has
+  if (NUM_HOSTED > 1) {
+    if (sscanf(buf, "%*s %d", &airport_num) != 1 || airport_num < FIRST_HOSTED ||
+        airport_num >= FIRST_HOSTED + NUM_HOSTED)
+      return NULL;
+    airport = &HOSTED[airport_num - FIRST_HOSTED];
+  }
+  CURRENT = airport;
+  AIRPORT_ID = airport->id;
+  AIRPORT_DATA = airport->data;
+  return airport;
+}
+
 void initialise_node(int airport_id, int num_gates, int listenfd) {
-  AIRPORT_ID = airport_id;
-  AIRPORT_DATA = create_airport(num_gates);
-  if (AIRPORT_DATA == NULL)
+  initialise_host(airport_id, 1, &num_gates, listenfd);
+}
+
+void initialise_host(int first_airport, int num_airports, int *gate_counts, int listenfd) {
+  create_hosted_airports(first_airport, num_airports, gate_counts);
+  airport_node_loop(listenfd);
+}
+
+void initialise_shm_node(int airport_id, int num_gates, shm_channel_t *chan) {
+  create_hosted_airports(airport_id, 1, &num_gates);
+  airport_shm_loop(chan);
+}
+
+/* Locks gates 0..num_gates - 1 in index order. Everything else only ever
+ * holds one gate lock at a time, so this can't deadlock. */
+static void lock_gates(int num_gates) {
+  for (int g = 0; g < num_gates; g++)
+    pthread_mutex_lock(&get_gate_by_idx(g)->lock);
+}
+
+static void unlock_gates(int num_gates) {
+  for (int g = num_gates - 1; g >= 0; g--)
+    pthread_mutex_unlock(&get_gate_by_idx(g)->lock);
+}
+
+/* Copies every placement at gates 0..num_gates - 1 into `recs`, in gate and
+ * then time order. The caller holds their locks. Returns the number of
+ * records. */
+static int collect_placements(dump_record_t *recs, int num_gates) {
+  int n = 0;
+  for (int g = 0; g < num_gates; g++) {
+    time_slot_t *slots = get_gate_by_idx(g)->time_slots;
+    for (int i = 0; i < NUM_TIME_SLOTS; i++) {
+      // one record per plane, taken from the slot it landed in
+      if (!slots[i].status || slots[i].start_time != i)
+        continue;
+      recs[n].gate = (uint32_t)g;
+      recs[n].plane_id = (uint32_t)slots[i].plane_id;
+      recs[n].start = (uint16_t)slots[i].start_time;
+      recs[n].end = (uint16_t)slots[i].end_time;
+      n++;
+    }
+  }
+  return n;
+}
+
+/* Rewrites gates 0..num_gates - 1 to hold exactly the placements in `recs`
+ * (sorted by gate), leaving alone any gate that already does. The caller holds
+ * every gate lock and has made the layout sequence number odd. Each gate is
+ * rewritten under its own `seq` too, since TIME_RANGE only checks the layout
+ * once it has copied every gate it wants. */
+static void lay_out_gates(dump_record_t *recs, int n, int num_gates) {
+  time_slot_t slots[NUM_TIME_SLOTS];
+  int r = 0;
+  for (int g = 0; g < num_gates; g++) {
+    gate_t *gate = get_gate_by_idx(g);
+    uint64_t bits = 0;
+    memset(slots, 0, sizeof(slots));
+    for (; r < n && recs[r].gate == (uint32_t)g; r++) {
+      for (int idx = recs[r].start; idx <= recs[r].end; idx++) {
+        set_time_slot(&slots[idx], (int)recs[r].plane_id, recs[r].start, recs[r].end);
+        bits |= (uint64_t)1 << idx;
+      }
+    }
+    if (memcmp(slots, gate->time_slots, sizeof(slots)) == 0)
+      continue;
+    __atomic_store_n(&gate->seq, gate->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(gate->time_slots, slots, sizeof(slots));
+    __atomic_store_n(&AIRPORT_DATA->segments[g / GATE_SEGMENT_SIZE]
+                          ->occupancy[g % GATE_SEGMENT_SIZE],
+                     bits, __ATOMIC_RELEASE);
+    __atomic_store_n(&gate->seq, gate->seq + 1, __ATOMIC_RELEASE);
+    gate->version++;
+  }
+}
+
+static void begin_layout(void) {
+  __atomic_store_n(&AIRPORT_DATA->layout_seq, AIRPORT_DATA->layout_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void end_layout(void) {
+  __atomic_store_n(&AIRPORT_DATA->layout_seq, AIRPORT_DATA->layout_seq + 1, __ATOMIC_RELEASE);
+}
+
+// a replica's stream from its primary
+static struct {
+  int port;
+  int fd;
+  rio_t rio;
+} PRIMARY = {0, -1};
+
+/* Places a plane the primary placed, unless it's here already (it will be if
+ * it came in both a snapshot and the stream before it). */
+static void apply_placement(int gate_num, int plane_id, int start, int end) {
+  gate_t *gate = get_gate_by_idx(gate_num);
+  if (!gate || start < 0 || end < start || end >= NUM_TIME_SLOTS)
+    return;
+  pthread_mutex_lock(&gate->lock);
+  if (!get_time_slot_by_idx(gate, start)->status)
+    add_plane_to_slots(gate, plane_id, start, end - start);
+  pthread_mutex_unlock(&gate->lock);
+}
+
+static void apply_gates(int total) {
+  int have = airport_num_gates();
+  if (total > have)
+    grow_airport(AIRPORT_DATA, total - have);
+}
+
+static int by_gate(const void *a, const void *b) {
+  const dump_record_t *x = a, *y = b;
+  if (x->gate != y->gate)
+    return x->gate < y->gate ? -1 : 1;
+  return (int)x->start - (int)y->start;
+}
+
+/* Reads the rest of a snapshot of the primary whose header line is `line`
+ * (see send_snapshot) and makes it this replica's state in one go, versions
+ * and all. Whatever was here before is replaced, the primary may have moved
+ * planes around since. Returns -1 if the stream broke off. */
+static int read_snapshot(char *line) {
+  int airport_num, num_gates, count, gate_num, plane_id, start, end, ret = 0;
+  unsigned long version;
+  if (sscanf(line, "REPLICA %d %d %d %lu", &airport_num, &num_gates, &count, &version) != 4 ||
+      num_gates <= 0 || num_gates > MAX_GATES || count < 0 ||
+      count > NUM_TIME_SLOTS * num_gates)
+    return -1;
+  dump_record_t *recs = malloc(sizeof(dump_record_t) * (size_t)(count ? count : 1));
+  unsigned long *versions = malloc(sizeof(unsigned long) * (size_t)num_gates);
+  if (!recs || !versions)
+    ret = -1;
+  for (int i = 0; i < count && ret == 0; i++) {
+    if (rio_readlineb(&PRIMARY.rio, line, MAXLINE) <= 0 ||
+        sscanf(line, "%d %d %d %d", &gate_num, &plane_id, &start, &end) != 4 || gate_num < 0 ||
+        gate_num >= num_gates || start < 0 || end < start || end >= NUM_TIME_SLOTS)
+      ret = -1;
+    else
+      recs[i] = (dump_record_t){(uint32_t)gate_num, (uint32_t)plane_id, (uint16_t)start,
+                                (uint16_t)end};
+  }
+  for (int g = 0; g < num_gates && ret == 0; g++)
+    if (rio_readlineb(&PRIMARY.rio, line, MAXLINE) <= 0 ||
+        sscanf(line, "GATE %d %lu", &gate_num, &versions[g]) != 2 || gate_num != g)
+      ret = -1;
+
+  if (ret == 0) {
+    apply_gates(num_gates);
+    qsort(recs, (size_t)count, sizeof(dump_record_t), by_gate);
+    lock_gates(num_gates);
+    begin_layout();
+    lay_out_gates(recs, count, num_gates);
+    for (int g = 0; g < num_gates; g++)
+      get_gate_by_idx(g)->version = versions[g];
+    __atomic_store_n(&AIRPORT_DATA->version, version, __ATOMIC_RELEASE);
+    end_layout();
+    unlock_gates(num_gates);
+  }
+  free(recs);
+  free(versions);
+  return ret;
+}
+
+/* (Re)connects to the primary and catches up with a fresh snapshot of it.
+ * Returns -1 if the primary can't be reached or won't replicate any more. */
+static int sync_with_primary(void) {
+  char port_str[16], line[MAXLINE];
+
+  if (PRIMARY.fd >= 0)
+    close(PRIMARY.fd);
+  snprintf(port_str, sizeof(port_str), "%d", PRIMARY.port);
+  PRIMARY.fd = open_clientfd_timeout("localhost", port_str, REPLICA_CONNECT_TIMEOUT_MS);
+  if (PRIMARY.fd < 0)
+    return -1;
+  int n = snprintf(line, MAXLINE, "REPLICATE %d\n", AIRPORT_ID);
+  if (rio_writen(PRIMARY.fd, line, (size_t)n) < 0)
+    return -1;
+  rio_readinitb(&PRIMARY.rio, PRIMARY.fd);
+  if (rio_readlineb(&PRIMARY.rio, line, MAXLINE) <= 0)
+    return -1;
+  return read_snapshot(line);
+}
+
+// keeps a replica up to date for as long as its primary is around
+static void *replica_thread(void *arg) {
+  char line[MAXLINE];
+  int gate_num, plane_id, start, end;
+  CURRENT = &HOSTED[0];
+  AIRPORT_ID = CURRENT->id;
+  AIRPORT_DATA = CURRENT->data;
+  while (1) {
+    int lost = rio_readlineb(&PRIMARY.rio, line, MAXLINE) <= 0 || strncmp(line, "LAGGED ", 7) == 0;
+    // the primary moved planes between gates, here's all of it again
+    if (!lost && strncmp(line, "REPLICA ", 8) == 0)
+      lost = read_snapshot(line) < 0;
+    else if (!lost &&
+             sscanf(line, "SCHEDULED %d %d %d %d", &gate_num, &plane_id, &start, &end) == 4)
+      apply_placement(gate_num, plane_id, start, end);
+    else if (!lost && sscanf(line, "GATES %d", &gate_num) == 1)
+      apply_gates(gate_num);
+    // lost the stream, start over from a snapshot
+    if (lost && sync_with_primary() < 0) {
+      fprintf(stderr, "[Airport %d] Replica lost its primary, exiting\n", AIRPORT_ID);
+      exit(0);
+    }
+  }
+  return NULL;
+}
+
+void initialise_replica(int airport_id, int num_gates, int listenfd, int primary_port) {
+  pthread_t tid;
+  READ_ONLY = 1;
+  create_hosted_airports(airport_id, 1, &num_gates);
+  CURRENT = &HOSTED[0];
+  AIRPORT_ID = CURRENT->id;
+  AIRPORT_DATA = CURRENT->data;
+  // caught up before telling anyone we're ready
+  PRIMARY.port = primary_port;
+  if (sync_with_primary() < 0 || pthread_create(&tid, NULL, replica_thread, NULL) != 0) {
+    fprintf(stderr, "[Airport %d] Replica could not reach its primary\n", airport_id);
     exit(1);
+  }
+  pthread_detach(tid);
   airport_node_loop(listenfd);
 }
 
@@ -234,167 +1065,1122 @@ void initialise_node(int airport_id, int num_gates, int listenfd) {
 // helperssss cus i aint reeading all that yfeel
 
 
-void schedule_please(int connfd, char *buf) {
-  char command[MAXLINE];
+void schedule_please(reply_t *out, char *buf) {
+  char command[REQUEST_MAX];
   int airport_num, plane_id, earliest_time, duration, fuel;
   int args_n = sscanf(buf, "%s %d %d %d %d %d",
                       command, &airport_num, &plane_id, &earliest_time, &duration, &fuel);
   if (args_n != 6) {
-    send_response(connfd, "Error: Invalid number of arguments for SCHEDULE\n");
+    reply(out, "Error: Invalid number of arguments for SCHEDULE\n");
     return;
   }
   if (earliest_time < 0 || earliest_time >= NUM_TIME_SLOTS) {
-    send_response(connfd, "Error: Invalid 'earliest' time (%d)\n", earliest_time);
+    reply(out, "Error: Invalid 'earliest' time (%d)\n", earliest_time);
     return;
   }
-  if (duration < 0 || earliest_time + duration > NUM_TIME_SLOTS) {
-    send_response(connfd, "Error: Invalid 'duration' value (%d)\n", duration);
+  // a plane takes slots earliest_time..earliest_time + duration
+  if (duration < 0 || earliest_time + duration >= NUM_TIME_SLOTS) {
+    reply(out, "Error: Invalid 'duration' value (%d)\n", duration);
     return;
   }
-  time_info_t result = schedule_plane(plane_id, earliest_time, duration, fuel);
+  time_info_t result = AIRPORT_CONFIG.combine
+                           ? combine_schedule(plane_id, earliest_time, duration, fuel)
+                           : schedule_plane(plane_id, earliest_time, duration, fuel);
   if (result.start_time >= 0) {
-    int start_hour = IDX_TO_HOUR(result.start_time);
-    int start_min = IDX_TO_MINS(result.start_time);
-    int end_hour = IDX_TO_HOUR(result.end_time);
-    int end_min = IDX_TO_MINS(result.end_time);
-    send_response(connfd, "SCHEDULED %d at GATE %d: %02d:%02d-%02d:%02d\n",
-                  plane_id, result.gate_number, start_hour, start_min, end_hour, end_min);
+    char scratch[REPLY_LINE_MAX], *line = reply_reserve(out, scratch), *p = line;
+    p = FMT_LIT(p, "SCHEDULED ");
+    p = fmt_int(p, plane_id);
+    p = FMT_LIT(p, " at GATE ");
+    p = fmt_int(p, result.gate_number);
+    p = FMT_LIT(p, ": ");
+    p = fmt_slot_range(p, result.start_time, result.end_time);
+    *p++ = '\n';
+    reply_commit(out, line, p);
   } else {
-    send_response(connfd, "Error: Cannot schedule %d\n", plane_id);
+    reply(out, "Error: Cannot schedule %d\n", plane_id);
   }
 }
 
 
 
-void plane_status(int connfd, char *buf) {
-  char command[MAXLINE];
+void plane_status(reply_t *out, char *buf) {
+  char command[REQUEST_MAX];
   int airport_num, plane_id;
   int args_n = sscanf(buf, "%s %d %d", command, &airport_num, &plane_id);
   if (args_n != 3) {
-    send_response(connfd, "Error: Invalid number of arguments for PLANE_STATUS\n");
+    reply(out, "Error: Invalid number of arguments for PLANE_STATUS\n");
     return;
   }
   time_info_t result = lookup_plane_in_airport(plane_id);
+  char scratch[REPLY_LINE_MAX], *line = reply_reserve(out, scratch), *p = line;
+  p = FMT_LIT(p, "PLANE ");
+  p = fmt_int(p, plane_id);
   if (result.gate_number >= 0) {
-    int start_hour = IDX_TO_HOUR(result.start_time);
-    int start_min = IDX_TO_MINS(result.start_time);
-    int end_hour = IDX_TO_HOUR(result.end_time);
-    int end_min = IDX_TO_MINS(result.end_time);
-    send_response(connfd, "PLANE %d scheduled at GATE %d: %02d:%02d-%02d:%02d\n",
-                  plane_id, result.gate_number, start_hour, start_min, end_hour, end_min);
-    fprintf(stderr, "%d %d %d %d", result.start_time, result.end_time, end_hour, end_min);
+    p = FMT_LIT(p, " scheduled at GATE ");
+    p = fmt_int(p, result.gate_number);
+    p = FMT_LIT(p, ": ");
+    p = fmt_slot_range(p, result.start_time, result.end_time);
   } else {
-    send_response(connfd, "PLANE %d not scheduled at airport %d\n", plane_id, AIRPORT_ID);
+    p = FMT_LIT(p, " not scheduled at airport ");
+    p = fmt_int(p, AIRPORT_ID);
   }
+  *p++ = '\n';
+  reply_commit(out, line, p);
 }
 
 
 
-void time_status(int connfd, char *buf) {
-  char command[MAXLINE];
+void time_status(reply_t *out, char *buf) {
+  char command[REQUEST_MAX];
   int airport_num, gate_num, start_idx, duration;
   int args_n = sscanf(buf, "%s %d %d %d %d",
                       command, &airport_num, &gate_num, &start_idx, &duration);
   if (args_n != 5) {
-    send_response(connfd, "Error: Invalid number of arguments for TIME_STATUS\n");
+    reply(out, "Error: Invalid number of arguments for TIME_STATUS\n");
     return;
   }
-  if (gate_num < 0 || gate_num >= AIRPORT_DATA->num_gates) {
-    send_response(connfd, "Error: Invalid 'gate' value (%d)\n", gate_num);
+  if (gate_num < 0 || gate_num >= airport_num_gates()) {
+    reply(out, "Error: Invalid 'gate' value (%d)\n", gate_num);
     return;
   }
   if (start_idx < 0 || start_idx >= NUM_TIME_SLOTS) {
-    send_response(connfd, "Error: Invalid 'start_idx' value (%d)\n", start_idx);
+    reply(out, "Error: Invalid 'start_idx' value (%d)\n", start_idx);
     return;
   }
-  if (duration <= 0 || start_idx + duration > NUM_TIME_SLOTS) {
-    send_response(connfd, "Error: Invalid 'duration' value (%d)\n", duration);
+  // the window takes in slot start_idx + duration as well
+  if (duration <= 0 || start_idx + duration >= NUM_TIME_SLOTS) {
+    reply(out, "Error: Invalid 'duration' value (%d)\n", duration);
     return;
   }
   gate_t *gate = get_gate_by_idx(gate_num);
   if (gate == NULL) {
-    send_response(connfd, "Error: Invalid 'gate' value (%d)\n", gate_num);
+    reply(out, "Error: Invalid 'gate' value (%d)\n", gate_num);
     return;
   }
-  // int end_idx = start_idx + duration;
+  // every line starts the same, so that part is only made once
+  char prefix[2 * FMT_INT_MAX + 16], scratch[REPLY_LINE_MAX];
+  char *prefix_end = FMT_LIT(prefix, "AIRPORT ");
+  prefix_end = fmt_int(prefix_end, AIRPORT_ID);
+  prefix_end = FMT_LIT(prefix_end, " GATE ");
+  prefix_end = fmt_int(prefix_end, gate_num);
+  *prefix_end++ = ' ';
+  size_t prefix_len = (size_t)(prefix_end - prefix);
   pthread_mutex_lock(&gate->lock);
   for (int i = 0; i <= duration; i++) {
     time_slot_t *time_slot = get_time_slot_by_idx(gate, start_idx+i);
-    char status = time_slot->status ? 'A' : 'F';
-    int flight_id = time_slot->plane_id;
-    int hour = IDX_TO_HOUR(start_idx+i);
-    int min = IDX_TO_MINS(start_idx+i);
-    send_response(connfd, "AIRPORT %d GATE %d %02d:%02d: %c - %d\n",
-                  AIRPORT_ID, gate_num, hour, min, status, flight_id);
+    char *line = reply_reserve(out, scratch);
+    char *p = fmt_text(line, prefix, prefix_len);
+    p = fmt_slot_time(p, start_idx + i);
+    p = FMT_LIT(p, ": ");
+    *p++ = time_slot->status ? 'A' : 'F';
+    p = FMT_LIT(p, " - ");
+    p = fmt_int(p, time_slot->plane_id);
+    *p++ = '\n';
+    reply_commit(out, line, p);
   }
   pthread_mutex_unlock(&gate->lock);
 }
 
+// one run of slots in a gate that are all free, or all taken by one plane
+typedef struct {
+  int gate, first, last;
+  int taken, plane_id;
+} slot_run_t;
 
-void process_commands(int connfd) {
-  char buf[MAXLINE];
-  rio_t rio;
-  rio_readinitb(&rio, connfd);
-  ssize_t n = rio_readlineb(&rio, buf, MAXLINE);
-  if (n <= 0) {
+/* Copies whether slots `start`..`end` of `gate` are taken, and by which plane,
+ * without taking the gate lock. Placements bump the gate's sequence number
+ * before and after writing its slots, so a copy made while the number was odd
+ * or that saw it change is thrown away and made again. */
+static void snapshot_gate(gate_t *gate, int start, int end, int *taken, int *plane_ids) {
+  unsigned before, after;
+  do {
+    while ((before = __atomic_load_n(&gate->seq, __ATOMIC_ACQUIRE)) & 1)
+      sched_yield();
+    for (int idx = start; idx <= end; idx++) {
+      taken[idx] = __atomic_load_n(&gate->time_slots[idx].status, __ATOMIC_RELAXED);
+      plane_ids[idx] = __atomic_load_n(&gate->time_slots[idx].plane_id, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&gate->seq, __ATOMIC_RELAXED);
+  } while (before != after);
+}
+
+/* TIME_RANGE <airport> <first_gate> <last_gate> <start_idx> <duration>: the
+ * same window as TIME_STATUS over a range of gates, as runs of slots that are
+ * free or taken by one plane instead of one line per slot. */
+void time_range(reply_t *out, char *buf) {
+  char command[REQUEST_MAX];
+  int airport_num, first_gate, last_gate, start_idx, duration;
+  int args_n = sscanf(buf, "%s %d %d %d %d %d", command, &airport_num, &first_gate,
+                      &last_gate, &start_idx, &duration);
+  if (args_n != 6) {
+    reply(out, "Error: Invalid number of arguments for TIME_RANGE\n");
+    return;
+  }
+  if (first_gate < 0 || last_gate < first_gate || last_gate >= airport_num_gates()) {
+    reply(out, "Error: Invalid gate range (%d-%d)\n", first_gate, last_gate);
+    return;
+  }
+  if (start_idx < 0 || start_idx >= NUM_TIME_SLOTS) {
+    reply(out, "Error: Invalid 'start_idx' value (%d)\n", start_idx);
+    return;
+  }
+  if (duration < 0 || start_idx + duration >= NUM_TIME_SLOTS) {
+    reply(out, "Error: Invalid 'duration' value (%d)\n", duration);
+    return;
+  }
+
+  int end_idx = start_idx + duration, num_runs = 0;
+  int taken[NUM_TIME_SLOTS], plane_ids[NUM_TIME_SLOTS];
+  slot_run_t *runs = malloc(sizeof(slot_run_t) * (size_t)(last_gate - first_gate + 1) *
+                            (size_t)(duration + 1));
+  if (!runs) {
+    reply(out, "Error: Out of memory\n");
+    return;
+  }
+  // each gate is copied as it was at some instant, and OPTIMIZE moving planes
+  // between them in the meantime sends us back to the first one
+  unsigned layout;
+  do {
+    num_runs = 0;
+    layout = layout_begin();
+    for (int g = first_gate; g <= last_gate; g++) {
+      snapshot_gate(get_gate_by_idx(g), start_idx, end_idx, taken, plane_ids);
+      for (int idx = start_idx; idx <= end_idx; idx++) {
+        if (idx > start_idx) {
+          slot_run_t *run = &runs[num_runs - 1];
+          if (run->taken == taken[idx] && (!taken[idx] || run->plane_id == plane_ids[idx])) {
+            run->last = idx;
+            continue;
+          }
+        }
+        runs[num_runs++] =
+            (slot_run_t){g, idx, idx, taken[idx], taken[idx] ? plane_ids[idx] : 0};
+      }
+    }
+  } while (layout_changed(layout));
+
+  char chunk[DUMP_CHUNK];
+  size_t len = (size_t)snprintf(chunk, sizeof(chunk), "TIME_RANGE %d %d\n", AIRPORT_ID, num_runs);
+  for (int i = 0; i < num_runs; i++) {
+    if (len + DUMP_MAX_RECORD > sizeof(chunk)) {
+      reply_raw(out, chunk, len);
+      len = 0;
+    }
+    char *p = fmt_int(chunk + len, runs[i].gate);
+    *p++ = ' ';
+    p = fmt_int(p, runs[i].first);
+    *p++ = ' ';
+    p = fmt_int(p, runs[i].last);
+    if (runs[i].taken) {
+      p = FMT_LIT(p, " A ");
+      p = fmt_int(p, runs[i].plane_id);
+    } else {
+      p = FMT_LIT(p, " F");
+    }
+    *p++ = '\n';
+    len = (size_t)(p - chunk);
+  }
+  reply_raw(out, chunk, len);
+  free(runs);
+}
+
+
+void gates_free(reply_t *out, char *buf) {
+  char command[REQUEST_MAX];
+  int airport_num, start_idx, duration;
+  int args_n = sscanf(buf, "%s %d %d %d", command, &airport_num, &start_idx, &duration);
+  if (args_n != 4) {
+    reply(out, "Error: Invalid number of arguments for GATES_FREE\n");
+    return;
+  }
+  if (start_idx < 0 || start_idx >= NUM_TIME_SLOTS) {
+    reply(out, "Error: Invalid 'start_idx' value (%d)\n", start_idx);
+    return;
+  }
+  if (duration < 0 || start_idx + duration >= NUM_TIME_SLOTS) {
+    reply(out, "Error: Invalid 'duration' value (%d)\n", duration);
+    return;
+  }
+
+  int num_gates = airport_num_gates();
+  int end_idx = start_idx + duration;
+  int *free_gates = malloc(sizeof(int) * (unsigned)num_gates);
+  // header plus up to 11 characters per gate number
+  size_t cap = MAXLINE + 12 * (size_t)num_gates;
+  char *line = malloc(cap);
+  if (!free_gates || !line) {
+    reply(out, "Error: Out of memory\n");
+    free(free_gates);
+    free(line);
+    return;
+  }
+
+  int found;
+  unsigned layout;
+  do {
+    found = 0;
+    layout = layout_begin();
+    for (int base = 0; base < num_gates; base += GATE_SEGMENT_SIZE) {
+      int in_segment =
+          num_gates - base < GATE_SEGMENT_SIZE ? num_gates - base : GATE_SEGMENT_SIZE;
+      int n = occupancy_find_free(AIRPORT_DATA->segments[base / GATE_SEGMENT_SIZE]->occupancy,
+                                  in_segment, OCC_MASK(start_idx, end_idx), free_gates + found);
+      for (int i = found; i < found + n; i++)
+        free_gates[i] += base;
+      found += n;
+    }
+  } while (layout_changed(layout));
+  char *p = FMT_LIT(line, "AIRPORT ");
+  p = fmt_int(p, AIRPORT_ID);
+  p = FMT_LIT(p, " FREE GATES ");
+  p = fmt_slot_range(p, start_idx, end_idx);
+  *p++ = ':';
+  for (int i = 0; i < found; i++) {
+    *p++ = ' ';
+    p = fmt_int(p, free_gates[i]);
+  }
+  *p++ = '\n';
+  reply_raw(out, line, (size_t)(p - line));
+  free(free_gates);
+  free(line);
+}
+
+void add_gates(reply_t *out, char *buf) {
+  char command[REQUEST_MAX];
+  int airport_num, count;
+  int args_n = sscanf(buf, "%s %d %d", command, &airport_num, &count);
+  if (args_n != 3) {
+    reply(out, "Error: Invalid number of arguments for ADD_GATES\n");
+    return;
+  }
+  if (count <= 0) {
+    reply(out, "Error: Invalid 'count' value (%d)\n", count);
+    return;
+  }
+  int total = grow_airport(AIRPORT_DATA, count);
+  if (total < 0) {
+    reply(out, "Error: Cannot add %d gates\n", count);
+    return;
+  }
+  // replicas need to grow too. Two of these racing may log their totals out
+  // of order, so readers only ever grow up to the largest one they've seen
+  change_event_t ev = {0, CHANGE_GATES_ADDED, total, 0, 0, 0};
+  change_log_append(&CURRENT->changes, &ev);
+  reply(out, "AIRPORT %d now has %d gates\n", AIRPORT_ID, total);
+}
+
+static int by_start(const void *a, const void *b) {
+  const dump_record_t *x = a, *y = b;
+  if (x->start != y->start)
+    return (int)x->start - (int)y->start;
+  return x->gate < y->gate ? -1 : x->gate > y->gate;
+}
+
+// min-heap of gate numbers for repack_airport
+static void heap_push(int *heap, int *n, int gate) {
+  int i = (*n)++;
+  for (; i > 0 && heap[(i - 1) / 2] > gate; i = (i - 1) / 2)
+    heap[i] = heap[(i - 1) / 2];
+  heap[i] = gate;
+}
+
+static int heap_pop(int *heap, int *n) {
+  int top = heap[0], last = heap[--*n], i = 0;
+  while (2 * i + 1 < *n) {
+    int child = 2 * i + 1;
+    if (child + 1 < *n && heap[child + 1] < heap[child])
+      child++;
+    if (heap[child] >= last)
+      break;
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+  return top;
+}
+
+/* Moves planes between gates so they take up as few gates as they can, each
+ * one keeping its time slots. Planes are taken in order of arrival and each
+ * goes to the lowest numbered gate that's free by then, which is what needs
+ * the fewest gates for a set of fixed times (and leaves a packed airport as
+ * it is). It's all worked out and written with every gate locked and the
+ * layout sequence number odd, so everyone sees the old layout or the new one.
+ *
+ * Returns the number of planes moved (setting `*empty` to the number of gates
+ * left with nothing at them), or -1 if it ran out of memory. */
+static int repack_airport(int *empty) {
+  int num_gates = airport_num_gates(), max = NUM_TIME_SLOTS * num_gates;
+  dump_record_t *recs = malloc(sizeof(dump_record_t) * (size_t)max);
+  int *to = malloc(sizeof(int) * (size_t)max), *after = malloc(sizeof(int) * (size_t)max);
+  int *heap = malloc(sizeof(int) * (size_t)num_gates);
+  int leaving[NUM_TIME_SLOTS], moved = 0;
+  if (!recs || !to || !after || !heap) {
+    free(recs);
+    free(to);
+    free(after);
+    free(heap);
+    return -1;
+  }
+
+  lock_gates(num_gates);
+  int n = collect_placements(recs, num_gates);
+  qsort(recs, (size_t)n, sizeof(dump_record_t), by_start);
+  // sorted, so already a heap
+  int free_n = num_gates;
+  for (int g = 0; g < num_gates; g++)
+    heap[g] = g;
+  // planes leaving at each slot, their gates are free again from the next one
+  for (int t = 0; t < NUM_TIME_SLOTS; t++)
+    leaving[t] = -1;
+  for (int i = 0, t = 0; t < NUM_TIME_SLOTS; t++) {
+    for (int p = t > 0 ? leaving[t - 1] : -1; p >= 0; p = after[p])
+      heap_push(heap, &free_n, to[p]);
+    // never runs dry, the layout we started from fits in these gates
+    for (; i < n && recs[i].start == t; i++) {
+      to[i] = heap_pop(heap, &free_n);
+      after[i] = leaving[recs[i].end];
+      leaving[recs[i].end] = i;
+      moved += to[i] != (int)recs[i].gate;
+    }
+  }
+
+  if (moved > 0) {
+    begin_layout();
+    for (int i = 0; i < n; i++) {
+      if (to[i] == (int)recs[i].gate)
+        continue;
+      change_event_t ev = {0, CHANGE_MOVED, to[i], (int)recs[i].plane_id, recs[i].start,
+                           recs[i].end, (int)recs[i].gate};
+      change_log_append(&CURRENT->changes, &ev);
+      recs[i].gate = (uint32_t)to[i];
+    }
+    qsort(recs, (size_t)n, sizeof(dump_record_t), by_gate);
+    lay_out_gates(recs, n, num_gates);
+    __atomic_fetch_add(&AIRPORT_DATA->version, 1, __ATOMIC_RELEASE);
+    end_layout();
+  }
+  *empty = 0;
+  for (int g = 0; g < num_gates; g++)
+    *empty += !AIRPORT_DATA->segments[g / GATE_SEGMENT_SIZE]->occupancy[g % GATE_SEGMENT_SIZE];
+  unlock_gates(num_gates);
+
+  free(recs);
+  free(to);
+  free(after);
+  free(heap);
+  return moved;
+}
+
+/* OPTIMIZE <airport>: gathers the free time at the airport onto as few gates
+ * as possible, see repack_airport. */
+void optimize_airport(reply_t *out, char *buf) {
+  char command[REQUEST_MAX];
+  int airport_num, empty;
+  int args_n = sscanf(buf, "%s %d", command, &airport_num);
+  if (args_n != 2) {
+    reply(out, "Error: Invalid number of arguments for OPTIMIZE\n");
+    return;
+  }
+  int moved = repack_airport(&empty);
+  if (moved < 0) {
+    reply(out, "Error: Out of memory\n");
+    return;
+  }
+  reply(out, "AIRPORT %d OPTIMIZED: %d planes moved, %d gates empty\n", AIRPORT_ID, moved,
+        empty);
+}
+
+// finish what's already been accepted, then this airport is done for good
+void retire_airport(reply_t *out, char *buf) {
+  hosted_airport_t *airport = CURRENT;
+  if (atomic_exchange(&airport->retiring, 1)) {
+    reply(out, "Error: Airport %d is retiring\n", AIRPORT_ID);
+    return;
+  }
+  // over shared memory requests are handled one at a time, nothing to wait on
+  if (!out->ring) {
+    wait_for_drain(&conn_queue, airport, out->ctx);
+    // the requests served meanwhile may have been for other airports
+    CURRENT = airport;
+    AIRPORT_ID = airport->id;
+    AIRPORT_DATA = airport->data;
+  }
+  reply(out, "AIRPORT %d RETIRED\n", AIRPORT_ID);
+  atomic_store(&airport->retired, 1);
+  atomic_fetch_add(&NUM_RETIRED, 1);
+}
+
+/* A DUMP TEXT record, `<gate> <plane_id> <start_idx> <end_idx>` and a newline.
+ * Never more than DUMP_MAX_RECORD bytes. */
+static char *fmt_dump_record(char *p, dump_record_t *rec) {
+  p = fmt_uint(p, rec->gate);
+  *p++ = ' ';
+  p = fmt_int(p, (int)rec->plane_id);
+  *p++ = ' ';
+  p = fmt_uint(p, rec->start);
+  *p++ = ' ';
+  p = fmt_uint(p, rec->end);
+  *p++ = '\n';
+  return p;
+}
+
+/* Copies every placement in the airport into `recs` while holding all the gate
+ * locks, so the result is a state the airport was actually in. Gates added
+ * while this runs are left out, they can't have anything in them yet.
+ *
+ * If `cursor` isn't NULL it also subscribes to the change log while the locks
+ * are held (changes are logged under their gate lock), so the cursor's first
+ * change is the first one the snapshot doesn't have. If `versions` isn't NULL
+ * it gets the version of each gate and then the airport's.
+ *
+ * Returns the number of records, or -1 if the subscription failed. */
+static int snapshot_airport(dump_record_t *recs, int num_gates, unsigned long *cursor,
+                            unsigned long *versions) {
+  int n = 0;
+  lock_gates(num_gates);
+  if (cursor && change_log_subscribe(&CURRENT->changes, cursor) < 0)
+    n = -1;
+  if (n == 0)
+    n = collect_placements(recs, num_gates);
+  for (int g = 0; versions && g < num_gates; g++)
+    versions[g] = get_gate_by_idx(g)->version;
+  if (versions)
+    versions[num_gates] = __atomic_load_n(&AIRPORT_DATA->version, __ATOMIC_ACQUIRE);
+  unlock_gates(num_gates);
+  return n;
+}
+
+void dump_airport(reply_t *out, char *buf) {
+  char command[REQUEST_MAX], format[REQUEST_MAX] = "TEXT";
+  int airport_num;
+  int args_n = sscanf(buf, "%s %d %s", command, &airport_num, format);
+  if (args_n < 2) {
+    reply(out, "Error: Invalid number of arguments for DUMP\n");
+    return;
+  }
+  int binary = strcmp(format, "BINARY") == 0;
+  if (!binary && strcmp(format, "TEXT") != 0) {
+    reply(out, "Error: Invalid format (%s)\n", format);
+    return;
+  }
+
+  // at most one plane can start in each slot
+  int num_gates = airport_num_gates();
+  dump_record_t *recs = malloc(sizeof(dump_record_t) * NUM_TIME_SLOTS * (unsigned)num_gates);
+  if (!recs) {
+    reply(out, "Error: Out of memory\n");
+    return;
+  }
+  int n = snapshot_airport(recs, num_gates, NULL, NULL);
+
+  // no locks held from here on, a slow reader only holds up this worker
+  char chunk[DUMP_CHUNK];
+  size_t len = (size_t)snprintf(chunk, sizeof(chunk), "DUMP %d %d %s\n", AIRPORT_ID, n,
+                                binary ? "BINARY" : "TEXT");
+  for (int i = 0; i < n; i++) {
+    if (len + DUMP_MAX_RECORD > sizeof(chunk)) {
+      reply_raw(out, chunk, len);
+      len = 0;
+    }
+    if (binary) {
+      dump_record_t rec = {htonl(recs[i].gate), htonl(recs[i].plane_id),
+                           htons(recs[i].start), htons(recs[i].end)};
+      memcpy(chunk + len, &rec, sizeof(rec));
+      len += sizeof(rec);
+    } else {
+      len = (size_t)(fmt_dump_record(chunk + len, &recs[i]) - chunk);
+    }
+  }
+  reply_raw(out, chunk, len);
+  free(recs);
+}
+
+/* Writes one change to a subscriber if it's one they asked for. Returns -1
+ * once the subscriber can't be written to any more. */
+static int send_change(watch_t *w, change_event_t *ev) {
+  char line[MAXLINE];
+  int moved = ev->type == CHANGE_MOVED;
+  // watchers only hear about planes, growing is for replicas
+  if (ev->type != CHANGE_SCHEDULED && !moved)
+    return 0;
+  // a plane moving off the gate being watched is news there as well
+  if ((w->gate >= 0 && ev->gate != w->gate && !(moved && ev->from_gate == w->gate)) ||
+      (w->plane_id >= 0 && ev->plane_id != w->plane_id))
+    return 0;
+  char *p = FMT_LIT(line, "EVENT ");
+  p = fmt_uint(p, ev->seq);
+  p = moved ? FMT_LIT(p, " MOVED ") : FMT_LIT(p, " SCHEDULED ");
+  p = fmt_int(p, ev->plane_id);
+  p = FMT_LIT(p, " at AIRPORT ");
+  p = fmt_int(p, AIRPORT_ID);
+  p = FMT_LIT(p, " GATE ");
+  p = fmt_int(p, ev->gate);
+  p = FMT_LIT(p, ": ");
+  p = fmt_slot_range(p, ev->start, ev->end);
+  if (moved) {
+    p = FMT_LIT(p, " FROM GATE ");
+    p = fmt_int(p, ev->from_gate);
+  }
+  *p++ = '\n';
+  int n = (int)(p - line);
+  return rio_writen(w->connfd, line, (size_t)n) < 0 ? -1 : 0;
+}
+
+/* Follows the change log for one WATCH connection until the client goes away
+ * or stops reading. Runs on its own thread so it never ties up a worker. */
+static void *watch_thread(void *arg) {
+  watch_t w = *(watch_t *)arg;
+  change_event_t evs[WATCH_BATCH];
+  unsigned long cursor, missed;
+  char line[MAXLINE], peek;
+  free(arg);
+
+  CURRENT = w.airport;
+  AIRPORT_ID = w.airport->id;
+  AIRPORT_DATA = w.airport->data;
+  if (change_log_subscribe(&CURRENT->changes, &cursor) < 0) {
+    close(w.connfd);
+    return NULL;
+  }
+
+  struct timeval send_timeout = {WATCH_SEND_TIMEOUT_MS / 1000,
+                                 (WATCH_SEND_TIMEOUT_MS % 1000) * 1000};
+  setsockopt(w.connfd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+  int n = snprintf(line, MAXLINE, "WATCHING %d\n", AIRPORT_ID);
+  if (rio_writen(w.connfd, line, (size_t)n) < 0) {
+    close(w.connfd);
+    return NULL;
+  }
+
+  while (1) {
+    n = change_log_read(&CURRENT->changes, &cursor, evs, WATCH_BATCH, &missed, WATCH_IDLE_MS);
+    // too slow to keep up, tell them how much they lost and carry on from there
+    if (missed) {
+      int len = snprintf(line, MAXLINE, "LAGGED %lu\n", missed);
+      if (rio_writen(w.connfd, line, (size_t)len) < 0)
+        break;
+    }
+    if (n == 0 && recv(w.connfd, &peek, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+      break; // hung up while nothing was happening
+    int i;
+    for (i = 0; i < n && send_change(&w, &evs[i]) == 0; i++)
+      ;
+    if (i < n)
+      break;
+  }
+  close(w.connfd);
+  return NULL;
+}
+
+/* Handles `WATCH <airport> [GATE <gate>] [PLANE <plane_id>]` by handing the
+ * connection to a watcher thread. Returns -1 if the request was invalid (the
+ * error has already been sent). */
+static int start_watch(int connfd, char *buf) {
+  char command[REQUEST_MAX], key[2][REQUEST_MAX];
+  int airport_num, value[2];
+  pthread_t tid;
+  watch_t *w = malloc(sizeof(watch_t));
+  reply_t out = {connfd, NULL};
+  int args_n = sscanf(buf, "%s %d %s %d %s %d", command, &airport_num, key[0], &value[0],
+                      key[1], &value[1]);
+
+  if (!w || args_n < 2 || args_n == 3 || args_n == 5) {
+    reply(&out, "Error: Invalid number of arguments for WATCH\n");
+    free(w);
+    return -1;
+  }
+  w->airport = CURRENT;
+  w->connfd = connfd;
+  w->gate = w->plane_id = -1;
+  for (int i = 0; i < (args_n - 2) / 2; i++) {
+    if (strcmp(key[i], "GATE") == 0 && value[i] >= 0 && value[i] < airport_num_gates()) {
+      w->gate = value[i];
+    } else if (strcmp(key[i], "PLANE") == 0) {
+      w->plane_id = value[i];
+    } else {
+      reply(&out, "Error: Invalid WATCH filter (%s %d)\n", key[i], value[i]);
+      free(w);
+      return -1;
+    }
+  }
+  if (pthread_create(&tid, NULL, watch_thread, w) != 0) {
+    reply(&out, "Error: Cannot start watching\n");
+    free(w);
+    return -1;
+  }
+  pthread_detach(tid);
+  return 0;
+}
+
+/* Sends a replica everything it needs to catch up: the header line
+ * `REPLICA <airport> <gates> <count> <version>`, `count` text records like
+ * DUMP's and a `GATE <gate> <version>` line for each gate, so the replica's
+ * versions match ours. Returns -1 if the replica can't be written to. */
+static int send_snapshot(int connfd, dump_record_t *recs, int num_gates, int n,
+                         unsigned long *versions) {
+  char chunk[DUMP_CHUNK];
+  size_t len = (size_t)snprintf(chunk, sizeof(chunk), "REPLICA %d %d %d %lu\n", AIRPORT_ID,
+                                num_gates, n, versions[num_gates]);
+  for (int i = 0; i < n + num_gates; i++) {
+    if (len + DUMP_MAX_RECORD > sizeof(chunk)) {
+      if (rio_writen(connfd, chunk, len) < 0)
+        return -1;
+      len = 0;
+    }
+    if (i < n) {
+      len = (size_t)(fmt_dump_record(chunk + len, &recs[i]) - chunk);
+    } else {
+      char *p = FMT_LIT(chunk + len, "GATE ");
+      p = fmt_int(p, i - n);
+      *p++ = ' ';
+      p = fmt_uint(p, versions[i - n]);
+      *p++ = '\n';
+      len = (size_t)(p - chunk);
+    }
+  }
+  return rio_writen(connfd, chunk, len) < 0 ? -1 : 0;
+}
+
+/* Takes a snapshot of the airport, subscribing `cursor` at the point it was
+ * taken, and sends it to a replica. Returns -1 if that didn't work out. */
+static int replicate_snapshot(int connfd, unsigned long *cursor) {
+  // no gates can be added between counting them and subscribing, so any
+  // that get added later are in the stream
+  pthread_mutex_lock(&AIRPORT_DATA->grow_lock);
+  int num_gates = AIRPORT_DATA->num_gates;
+  dump_record_t *recs = malloc(sizeof(dump_record_t) * NUM_TIME_SLOTS * (unsigned)num_gates);
+  unsigned long *versions = malloc(sizeof(unsigned long) * (size_t)(num_gates + 1));
+  int n = recs && versions ? snapshot_airport(recs, num_gates, cursor, versions) : -1;
+  pthread_mutex_unlock(&AIRPORT_DATA->grow_lock);
+  if (n >= 0)
+    n = send_snapshot(connfd, recs, num_gates, n, versions);
+  free(recs);
+  free(versions);
+  return n < 0 ? -1 : 0;
+}
+
+/* Streams this airport to a replica: a snapshot taken at a known point in the
+ * change log, then every change after that point as `SCHEDULED <gate>
+ * <plane_id> <start> <end>` or `GATES <count>` lines. Planes moved by OPTIMIZE
+ * aren't sent one by one, the replica couldn't move them all at once, so a
+ * whole new snapshot goes instead. A replica that falls more than a log behind
+ * is sent `LAGGED <n>` and dropped, it has to ask for a new snapshot. Runs on
+ * its own thread, like a watcher. */
+static void *replicate_thread(void *arg) {
+  watch_t w = *(watch_t *)arg;
+  change_event_t evs[WATCH_BATCH];
+  unsigned long cursor, missed;
+  char line[MAXLINE], peek;
+  free(arg);
+
+  CURRENT = w.airport;
+  AIRPORT_ID = w.airport->id;
+  AIRPORT_DATA = w.airport->data;
+  struct timeval send_timeout = {WATCH_SEND_TIMEOUT_MS / 1000,
+                                 (WATCH_SEND_TIMEOUT_MS % 1000) * 1000};
+  setsockopt(w.connfd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+  if (replicate_snapshot(w.connfd, &cursor) < 0) {
+    close(w.connfd);
+    return NULL;
+  }
+
+  int n;
+  while (1) {
+    n = change_log_read(&CURRENT->changes, &cursor, evs, WATCH_BATCH, &missed, WATCH_IDLE_MS);
+    if (missed) {
+      int len = snprintf(line, MAXLINE, "LAGGED %lu\n", missed);
+      rio_writen(w.connfd, line, (size_t)len);
+      break;
+    }
+    if (n == 0 && recv(w.connfd, &peek, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+      break;
+    size_t len = 0;
+    char batch[WATCH_BATCH * DUMP_MAX_RECORD];
+    int i, moved = 0;
+    for (i = 0; i < n && !moved; i++) {
+      if (evs[i].type == CHANGE_GATES_ADDED)
+        len += (size_t)snprintf(batch + len, sizeof(batch) - len, "GATES %d\n", evs[i].gate);
+      else if (evs[i].type == CHANGE_MOVED)
+        moved = 1; // the rest of the batch is in the new snapshot
+      else
+        len += (size_t)snprintf(batch + len, sizeof(batch) - len, "SCHEDULED %d %d %d %d\n",
+                                evs[i].gate, evs[i].plane_id, evs[i].start, evs[i].end);
+    }
+    if (len && rio_writen(w.connfd, batch, len) < 0)
+      break;
+    if (moved && replicate_snapshot(w.connfd, &cursor) < 0)
+      break;
+  }
+  close(w.connfd);
+  return NULL;
+}
+
+/* Handles `REPLICATE <airport>` from a replica of this airport by handing the
+ * connection to a thread of its own. */
+static void start_replicate(int connfd) {
+  pthread_t tid;
+  watch_t *w = malloc(sizeof(watch_t));
+  if (!w) {
+    close(connfd);
+    return;
+  }
+  w->airport = CURRENT;
+  w->connfd = connfd;
+  w->gate = w->plane_id = -1;
+  if (pthread_create(&tid, NULL, replicate_thread, w) != 0) {
+    free(w);
     close(connfd);
     return;
   }
-  char command[MAXLINE];
+  pthread_detach(tid);
+}
+
+/* Handles the version check of a read ending in `CACHED <version>` (or
+ * `CACHED -`), sent by the controller's read cache. A TIME_STATUS is versioned
+ * by its gate and a PLANE_STATUS by the whole airport. If the version hasn't
+ * moved, the reply is just `NOT_MODIFIED <version>` and this returns 1.
+ * Otherwise `VERSION <version>` goes ahead of the normal reply. A version is
+ * read before the reply is worked out, so it can only be older than the
+ * reply, which makes the cache ask again sooner rather than never. */
+static int check_cached(reply_t *out, char *command, char *buf) {
+  unsigned long version, cached;
+  int have_cached = sscanf(strstr(buf, " CACHED "), " CACHED %lu", &cached) == 1;
+  if (strcmp(command, "TIME_STATUS") == 0) {
+    int gate_num;
+    gate_t *gate;
+    if (sscanf(buf, "%*s %*d %d", &gate_num) != 1 || (gate = get_gate_by_idx(gate_num)) == NULL)
+      return 0; // the error isn't cached
+    pthread_mutex_lock(&gate->lock);
+    version = gate->version;
+    pthread_mutex_unlock(&gate->lock);
+  } else if (strcmp(command, "PLANE_STATUS") == 0) {
+    version = __atomic_load_n(&AIRPORT_DATA->version, __ATOMIC_ACQUIRE);
+  } else {
+    return 0;
+  }
+  if (have_cached && cached == version) {
+    reply(out, "NOT_MODIFIED %lu\n", version);
+    return 1;
+  }
+  reply(out, "VERSION %lu\n", version);
+  return 0;
+}
+
+/* Dispatches a single request line to its handler. */
+static void handle_request(reply_t *out, char *buf) {
+  char command[REQUEST_MAX];
   int args_n = sscanf(buf, "%s", command);
 
   if (args_n < 1) {
-    send_response(connfd, "Error: Invalid request provided\n");
-    close(connfd);
+    reply(out, "Error: Invalid request provided\n");
+    return;
+  }
+  if (use_airport(buf) == NULL) {
+    reply(out, "Error: Airport not hosted here\n");
+    return;
+  }
+  if (READ_ONLY && (strcmp(command, "SCHEDULE") == 0 || strcmp(command, "ADD_GATES") == 0 ||
+                    strcmp(command, "RETIRE") == 0 || strcmp(command, "WATCH") == 0 ||
+                    strcmp(command, "REPLICATE") == 0 || strcmp(command, "OPTIMIZE") == 0)) {
+    reply(out, "Error: Airport %d replica is read-only\n", AIRPORT_ID);
     return;
   }
+  // without -c nobody sends these, and a client's `CACHED` is just more arguments
+  if (AIRPORT_CONFIG.read_cache && strstr(buf, " CACHED ") && check_cached(out, command, buf))
+    return;
 
   if (strcmp(command, "SCHEDULE") == 0) {
-    schedule_please(connfd, buf);
+    schedule_please(out, buf);
   } else if (strcmp(command, "PLANE_STATUS") == 0) {
-    plane_status(connfd, buf);
+    plane_status(out, buf);
   } else if (strcmp(command, "TIME_STATUS") == 0) {
-    time_status(connfd, buf);
+    time_status(out, buf);
+  } else if (strcmp(command, "TIME_RANGE") == 0) {
+    time_range(out, buf);
+  } else if (strcmp(command, "GATES_FREE") == 0) {
+    gates_free(out, buf);
+  } else if (strcmp(command, "DUMP") == 0) {
+    dump_airport(out, buf);
+  } else if (strcmp(command, "ADD_GATES") == 0) {
+    add_gates(out, buf);
+  } else if (strcmp(command, "OPTIMIZE") == 0) {
+    optimize_airport(out, buf);
+  } else if (strcmp(command, "RETIRE") == 0) {
+    retire_airport(out, buf);
+  } else if (strcmp(command, "WATCH") == 0) {
+    // only reaches here over shared memory, where there's no connection to keep
+    reply(out, "Error: WATCH needs its own connection\n");
   } else {
-    send_response(connfd, "Error: Invalid request provided\n");
+    reply(out, "Error: Invalid request provided\n");
   }
-  close(connfd);
+}
+
+void process_commands(conn_item_t *item, conn_ctx_t *ctx) {
+  reply_t out = {item->connfd, NULL, ctx};
+  // nobody is waiting for this answer any more, don't bother working it out
+  int deadline_ms = take_deadline(item->line);
+  if (deadline_ms < 0)
+    reply(&out, "Error: Invalid DEADLINE argument\n");
+  else if (deadline_ms > 0 && now_ms() - item->arrival_ms > deadline_ms)
+    reply(&out, "Error: Deadline exceeded\n");
+  else
+    handle_request(&out, item->line);
+  reply_flush(&out);
+  close(item->connfd);
 }
 
 static void *airport_thread(void *arg) {
-  while (1) {
-    int connfd = dequeue_please(&conn_queue);
-    process_commands(connfd);
+  conn_queue_t *queue = arg;
+  conn_item_t item;
+  // kept for every request this worker serves, and handed on when it exits
+  conn_ctx_t *ctx = ctx_take();
+  while (dequeue_please(queue, &item) == 0) {
+    process_commands(&item, ctx);
+    if (atomic_load(&NUM_RETIRED) == NUM_HOSTED)
+      exit(0);
+    request_done(queue, &item);
   }
+  ctx_give(ctx);
   return NULL;
 }
 
+/* Starts a worker that has already been counted in `p->workers`. */
+static int start_worker(conn_queue_t *p) {
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, airport_thread, p) != 0) {
+    pthread_mutex_lock(&p->mutex);
+    p->workers--;
+    pthread_mutex_unlock(&p->mutex);
+    return -1;
+  }
+  pthread_detach(thread);
+  return 0;
+}
+
 void create_worker_threads(conn_queue_t *queue, int num_threads) {
-  pthread_t thread_interface[MAX_THREADS];
-  queue_init(&conn_queue);
-  for (int i = 0; i < MAX_THREADS; i++) {
-      pthread_create(&thread_interface[i], NULL, airport_thread, NULL);
-      pthread_detach(thread_interface[i]);
+  if (AIRPORT_CONFIG.max_workers == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    AIRPORT_CONFIG.max_workers = cpus < MAX_THREADS ? MAX_THREADS
+                                 : cpus > MAX_WORKERS ? MAX_WORKERS : (int)cpus;
   }
+  if (AIRPORT_CONFIG.max_workers < num_threads)
+    AIRPORT_CONFIG.max_workers = num_threads;
+  queue_init(queue);
+  pthread_mutex_lock(&queue->mutex);
+  queue->workers = num_threads;
+  pthread_mutex_unlock(&queue->mutex);
+  for (int i = 0; i < num_threads; i++)
+    start_worker(queue);
 }
 
 
+static void refuse_long_request(int connfd) {
+  reply_t out = {connfd, NULL, NULL};
+  reply(&out, "Error: Request too long\n");
+  close(connfd);
+}
+
+/* Files a freshly read request into its lane, or turns it away with BUSY if
+ * we're already too far behind. Either way the connection is dealt with. */
+static void admit_request(conn_item_t *item) {
+  hosted_airport_t *airport = use_airport(item->line);
+  if (airport && atomic_load(&airport->retiring)) {
+    reply_t out = {item->connfd, NULL};
+    reply(&out, "Error: Airport %d is retiring\n", AIRPORT_ID);
+    close(item->connfd);
+    return;
+  }
+  // subscriptions last as long as the connection, they don't queue for a worker
+  if (airport && !READ_ONLY && strncmp(item->line, "WATCH ", 6) == 0) {
+    if (start_watch(item->connfd, item->line) < 0)
+      close(item->connfd);
+    return;
+  }
+  if (airport && !READ_ONLY && strncmp(item->line, "REPLICATE ", 10) == 0) {
+    start_replicate(item->connfd);
+    return;
+  }
+  item->lane = classify_request(item->line);
+  item->airport = airport;
+  if (queue_please(&conn_queue, item) < 0) {
+    send(item->connfd, "BUSY\n", 5, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(item->connfd);
+  }
+}
+
+#ifdef USE_IO_URING
+static int airport_on_line(int connfd, char *line, void *arg) {
+  conn_item_t *item = arg;
+  item->connfd = connfd;
+  item->arrival_ms = now_ms();
+  if (strlen(line) >= REQUEST_MAX) {
+    refuse_long_request(connfd);
+    return 0;
+  }
+  strcpy(item->line, line);
+  admit_request(item);
+  return 0; // the worker closes it when it's done
+}
+#endif
+
+/* A connection the accept thread is still waiting on for a request line. */
+typedef struct {
+  int connfd;
+  long arrival_ms;
+  size_t len;
+  char line[REQUEST_MAX];
+} pending_read_t;
+
+/* Reads whatever has arrived on a pending connection, without waiting for
+ * more. Returns 1 once it holds a whole line (or the client has finished
+ * sending), 0 if there's more to come and -1 if the connection has been dealt
+ * with. */
+static int read_pending(pending_read_t *r) {
+  ssize_t n = recv(r->connfd, r->line + r->len, REQUEST_MAX - 1 - r->len, MSG_DONTWAIT);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return 0;
+  if (n <= 0) {
+    if (n == 0 && r->len > 0)
+      return 1;
+    close(r->connfd);
+    return -1;
+  }
+  r->len += (size_t)n;
+  r->line[r->len] = '\0';
+  char *newline = memchr(r->line, '\n', r->len);
+  if (newline) {
+    newline[1] = '\0'; // anything after the line was never looked at
+    return 1;
+  }
+  if (r->len == REQUEST_MAX - 1) {
+    refuse_long_request(r->connfd);
+    return -1;
+  }
+  return 0;
+}
+
+/* Files a pending connection's request. */
+static void admit_pending(pending_read_t *r) {
+  conn_item_t item;
+  item.connfd = r->connfd;
+  item.arrival_ms = r->arrival_ms;
+  memcpy(item.line, r->line, REQUEST_MAX);
+  admit_request(&item);
+}
+
 void airport_node_loop(int listenfd) {
+// the controller may give up on us mid-reply, that shouldn't kill the airport
+signal(SIGPIPE, SIG_IGN);
 // start making threads
-create_worker_threads(&conn_queue, MAX_THREADS);
+create_worker_threads(&conn_queue, AIRPORT_CONFIG.min_workers);
+announce_ready();
 
 // always listen cus we dont know how to speak
+#ifdef USE_IO_URING
+  conn_item_t item;
+  // reads every pending request line at once instead of one connection at a time
+  uring_serve(listenfd, airport_on_line, NULL, &item);
+  fprintf(stderr, "[Airport %d] io_uring unavailable, using poll()\n", AIRPORT_ID);
+#endif
+  // a connection that's gone again by the time we accept it mustn't block us
+  // (accepted ones don't inherit this on Linux)
+  fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+  // connections whose request line hasn't all arrived yet, so one slow client
+  // doesn't hold up everyone else's requests
+  pending_read_t pending[MAX_PENDING_READS];
+  struct pollfd fds[MAX_PENDING_READS + 1];
+  int num_pending = 0;
   while (1) {
-    int connfd;
-    struct sockaddr_storage clientaddr; // store mamangers address
-    socklen_t clientlen = sizeof(struct sockaddr_storage);
-     // we're lonely so we accept the first connection we recieve without security
-    connfd = accept(listenfd, (struct sockaddr *)&clientaddr, &clientlen);
-    if (connfd < 0) { // something happened and the connection was unable to be established
-        fprintf(stderr, "[Airport %d] Accept error: %s\n", AIRPORT_ID, strerror(errno));
-        continue;
+    long now = now_ms();
+    int timeout = -1;
+    // no more connections are taken while we're waiting on too many
+    fds[0] = (struct pollfd){num_pending < MAX_PENDING_READS ? listenfd : -1, POLLIN, 0};
+    for (int i = 0; i < num_pending; i++) {
+      fds[i + 1] = (struct pollfd){pending[i].connfd, POLLIN, 0};
+      long left = pending[i].arrival_ms + REQUEST_READ_TIMEOUT_MS - now;
+      if (timeout < 0 || left < timeout)
+        timeout = left > 0 ? (int)left : 0;
+    }
+    if (poll(fds, (nfds_t)num_pending + 1, timeout) < 0) {
+      if (errno != EINTR)
+        fprintf(stderr, "[Airport %d] poll error: %s\n", AIRPORT_ID, strerror(errno));
+      continue;
+    }
+
+    // the ones still waiting stay in the order they were accepted in
+    int kept = 0;
+    now = now_ms();
+    for (int i = 0; i < num_pending; i++) {
+      int rc = 0;
+      if (fds[i + 1].revents)
+        rc = read_pending(&pending[i]);
+      if (rc == 0 && now - pending[i].arrival_ms >= REQUEST_READ_TIMEOUT_MS) {
+        close(pending[i].connfd);
+        rc = -1;
+      }
+      if (rc == 0)
+        pending[kept++] = pending[i];
+      else if (rc == 1)
+        admit_pending(&pending[i]); // put request into queue ie run the threads
+    }
+    num_pending = kept;
+
+    if (fds[0].revents & POLLIN) {
+      struct sockaddr_storage clientaddr; // store mamangers address
+      socklen_t clientlen = sizeof(struct sockaddr_storage);
+      // we're lonely so we accept the first connection we recieve without security
+      int connfd = accept(listenfd, (struct sockaddr *)&clientaddr, &clientlen);
+      if (connfd < 0) { // something happened and the connection was unable to be established
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+          fprintf(stderr, "[Airport %d] Accept error: %s\n", AIRPORT_ID, strerror(errno));
+      } else {
+        // find out what they want so it can go in the right lane, it's
+        // usually all there already
+        pending_read_t *r = &pending[num_pending];
+        *r = (pending_read_t){connfd, now_ms(), 0, ""};
+        int rc = read_pending(r);
+        if (rc == 1)
+          admit_pending(r);
+        else if (rc == 0)
+          num_pending++;
+      }
+    }
+  }
+}
+
+
+void airport_shm_loop(shm_channel_t *chan) {
+  reply_t out = {-1, &chan->response, ctx_take()};
+  char buf[REQUEST_MAX], rec[SHM_RECORD_DATA];
+  size_t len, take;
+  ssize_t n;
+  int end, too_long;
+
+  announce_ready();
+  // the controller is the only producer, so requests are handled in order here
+  while (1) {
+    len = 0;
+    too_long = 0;
+    do {
+      n = shm_ring_read(&chan->request, rec, sizeof(rec), &end, -1);
+      take = (size_t)n < sizeof(buf) - 1 - len ? (size_t)n : sizeof(buf) - 1 - len;
+      too_long |= take < (size_t)n;
+      memcpy(buf + len, rec, take);
+      len += take;
+    } while (!end);
+    buf[len] = '\0';
+    if (too_long) {
+      reply(&out, "Error: Request too long\n");
+    } else if (take_deadline(buf) < 0) {
+      reply(&out, "Error: Invalid DEADLINE argument\n");
+    } else {
+      // nothing waits in a queue here, the DEADLINE pair only has to go
+      handle_request(&out, buf);
     }
-    // put connection into queue ie run the threads
-    queue_please(&conn_queue, connfd);
+    reply_flush(&out);
+    shm_ring_write(&chan->response, NULL, 0, 1, -1);
+    if (atomic_load(&NUM_RETIRED) == NUM_HOSTED)
+      exit(0);
   }
 }
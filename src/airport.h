@@ -2,9 +2,11 @@
 #define AIRPORT_HEADER
 
 #include "network_utils.h"
+#include "shm_ring.h"
 #include <bits/pthreadtypes.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,6 +22,25 @@
 #define LOG(...)
 #endif
 
+/* Maximum number of connections waiting for a worker in an airport node. */
+#define MAX_QUEUE 16
+
+/* Most worker threads an airport node's pool may grow to. */
+#define MAX_WORKERS 64
+
+/* A worker above the pool's minimum that has gone this long without a request
+ * exits. */
+#define WORKER_IDLE_MS 2000
+
+/* Requests are a command and a handful of numbers (plus whatever the
+ * controller adds, like `CACHED` or `DEADLINE`), so airports read them into
+ * buffers this size rather than MAXLINE. A line this long or longer, newline
+ * included, is refused. */
+#define REQUEST_MAX 256
+
+/* SCHEDULE requests with at most this much fuel jump the queue by default. */
+#define DEFAULT_URGENT_FUEL 4
+
 /* Each gate schedules is broken up into 48 half-hour time slots. */
 #define NUM_TIME_SLOTS 48
 
@@ -53,18 +74,41 @@ struct gate_t {
   time_slot_t time_slots[NUM_TIME_SLOTS];
   // add for multithreading.
   pthread_mutex_t lock;
+  int index; // Position of this gate in its airport
+  unsigned long version; // Placements made at this gate, see `CACHED`
+  unsigned seq; // Odd while the slots are being written, see `snapshot_gate`
 };
 
 typedef struct gate_t gate_t;
 
-/** Each airport has a number of gates, and an array of those gate schedules.
- *  @note: This structure definition uses a "flexible array member" to represent
- *         the variable number of gates.
+/* Gates live in segments of this many, which are never moved or freed once
+ * published, so an airport can gain gates while requests use the old ones. */
+#define GATE_SEGMENT_SIZE 64
+#define MAX_GATE_SEGMENTS 1024
+#define MAX_GATES (GATE_SEGMENT_SIZE * MAX_GATE_SEGMENTS)
+
+/** One segment of an airport's gates, along with their occupancy bitmaps
+ *  (see occupancy.h). The bitmaps come first so they get the segment's
+ *  alignment.
+ */
+typedef struct gate_segment_t gate_segment_t;
+struct gate_segment_t {
+  uint64_t occupancy[GATE_SEGMENT_SIZE];
+  gate_t gates[GATE_SEGMENT_SIZE];
+};
+
+/** Each airport has a number of gates, stored in segments.
+ *  @note: `num_gates` is only ever increased, with a release store made after
+ *         the segments holding the new gates have been published. Anything
+ *         that loads it with acquire semantics can use every gate below it
+ *         without taking `grow_lock`.
  */
 struct airport_t {
   int num_gates;  // Number of gates in this airport
-  gate_t gates[]; // Array of each gate.
-  // might need to add mutex for threading.
+  unsigned long version; // Placements made, gates added and layouts, see `CACHED`
+  unsigned layout_seq; // Odd while OPTIMIZE moves planes between gates, see `layout_begin`
+  pthread_mutex_t grow_lock; // Held while adding gates
+  gate_segment_t *segments[MAX_GATE_SEGMENTS];
 };
 
 /** This structure is used to represent a (gate index, start time, end time)
@@ -78,6 +122,55 @@ struct time_info_t {
   int end_time;
 };
 
+/** One placed plane, as sent by `DUMP <airport> BINARY`. On the wire every
+ *  field is in network byte order, and records follow the header line
+ *  `DUMP <airport> <count> BINARY` back to back with no padding.
+ */
+typedef struct dump_record_t dump_record_t;
+struct dump_record_t {
+  uint32_t gate;     /* Gate the plane is parked at */
+  uint32_t plane_id; /* ID of the plane */
+  uint16_t start;    /* Index of the first time slot it occupies */
+  uint16_t end;      /* Index of the last time slot it occupies */
+};
+
+/** Admission control settings shared by every airport node. */
+typedef struct airport_config_t airport_config_t;
+
+struct airport_config_t {
+  /* Once this many connections are waiting for a worker, new ones are sent
+   * `BUSY` and closed instead of being queued. At most `MAX_QUEUE`. */
+  int queue_watermark;
+  /* Milliseconds a request may wait in the queue before it is dropped, for
+   * requests that don't carry their own `DEADLINE <ms>`. 0 means no limit. */
+  int default_deadline_ms;
+  /* SCHEDULE requests with `fuel` at or below this are served before any
+   * other request waiting in the queue. */
+  int urgent_fuel;
+  /* Worker threads a node keeps even when it has nothing to do. More are
+   * started, up to `max_workers`, whenever a request is queued and no worker
+   * is free to take it (including when they're all blocked on a gate or a
+   * slow client), and the extra ones exit after `WORKER_IDLE_MS` idle. A
+   * `max_workers` of 0 means one per online CPU, at least 4. */
+  int min_workers;
+  int max_workers;
+  /* When set, SCHEDULEs for an airport are published to a list and placed in
+   * batches by whichever worker takes the combiner role, one pass over the
+   * gates per batch, instead of each worker locking its way along the gates
+   * on its own. */
+  int combine;
+  /* Set when the controller caches reads (`-c`). Only then is a trailing
+   * `CACHED <version>` on a PLANE_STATUS or TIME_STATUS a version check. */
+  int read_cache;
+  /* Write end of a pipe the controller is waiting on at startup. A node
+   * writes one byte to it (and closes it) once it is serving requests. -1 if
+   * nobody is waiting. */
+  int ready_fd;
+};
+
+/* Set by the controller before the airport nodes are forked. */
+extern airport_config_t AIRPORT_CONFIG;
+
 /** Helper functions and macros defined for you to use. */
 
 /** @brief Allocates sufficient memory for an airport struct containing all
@@ -92,6 +185,13 @@ struct time_info_t {
  */
 airport_t *create_airport(int num_gates);
 
+/** @brief Adds `count` empty gates to the end of `data`, without blocking
+ *         requests that are using its existing gates.
+ *
+ *  @returns The new number of gates, or -1 if the gates could not be added.
+ */
+int grow_airport(airport_t *data, int count);
+
 /** @brief This function is called after forking a child process to instantiate
  *         and run an individual airport node.
  *
@@ -105,6 +205,29 @@ airport_t *create_airport(int num_gates);
  */
 void initialise_node(int airport_id, int num_gates, int listenfd);
 
+/** @brief Same as `initialise_node`, but one process (with one listening
+ *         socket and one pool of worker threads) serves the airports
+ *         `first_airport`..`first_airport + num_airports - 1`. Requests are
+ *         routed by the airport number they carry.
+ *
+ *  @param gate_counts The number of gates of each of those airports.
+ */
+void initialise_host(int first_airport, int num_airports, int *gate_counts, int listenfd);
+
+/** @brief Same as `initialise_node`, but the airport serves requests arriving
+ *         on the shared-memory channel `chan` instead of a listening socket.
+ */
+void initialise_shm_node(int airport_id, int num_gates, shm_channel_t *chan);
+
+/** @brief Same as `initialise_node`, but runs a read-only replica of the
+ *         airport whose node listens on `primary_port`. The replica copies a
+ *         snapshot of the primary before it starts serving, then applies the
+ *         primary's changes as they're streamed to it. It refuses anything
+ *         that would change the airport, and exits once the primary stops
+ *         replicating to it (the primary retired or died).
+ */
+void initialise_replica(int airport_id, int num_gates, int listenfd, int primary_port);
+
 /** The following functions all require the airport to be instantiated  */
 
 /** @brief Returns a pointer to the `gate_idx`th gate schedule of the "global"
@@ -209,4 +332,10 @@ time_info_t schedule_plane(int plane_id, int start, int duration, int fuel);
  */
 void airport_node_loop(int listenfd);
 
+/** @brief The server loop for an airport node using the shared-memory
+ *         transport. Requests are read from `chan->request` and every response
+ *         is written to `chan->response`, terminated by an end record.
+ */
+void airport_shm_loop(shm_channel_t *chan);
+
 #endif
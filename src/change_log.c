@@ -0,0 +1,67 @@
+#include "change_log.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+void change_log_init(change_log_t *log) {
+  pthread_condattr_t attr;
+  log->events = NULL;
+  log->next_seq = 0;
+  pthread_mutex_init(&log->lock, NULL);
+  // timed waits shouldn't jump around when the wall clock does
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&log->changed, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+void change_log_append(change_log_t *log, change_event_t *ev) {
+  pthread_mutex_lock(&log->lock);
+  ev->seq = log->next_seq++;
+  if (log->events)
+    log->events[ev->seq & (CHANGE_LOG_SIZE - 1)] = *ev;
+  pthread_cond_broadcast(&log->changed);
+  pthread_mutex_unlock(&log->lock);
+}
+
+int change_log_subscribe(change_log_t *log, unsigned long *cursor) {
+  pthread_mutex_lock(&log->lock);
+  if (!log->events)
+    log->events = malloc(sizeof(change_event_t) * CHANGE_LOG_SIZE);
+  *cursor = log->next_seq;
+  int ret = log->events ? 0 : -1;
+  pthread_mutex_unlock(&log->lock);
+  return ret;
+}
+
+int change_log_read(change_log_t *log, unsigned long *cursor, change_event_t *out, int max,
+                    unsigned long *missed, int timeout_ms) {
+  struct timespec deadline;
+  int n = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&log->lock);
+  while (*cursor == log->next_seq) {
+    if (timeout_ms < 0)
+      pthread_cond_wait(&log->changed, &log->lock);
+    else if (pthread_cond_timedwait(&log->changed, &log->lock, &deadline) == ETIMEDOUT)
+      break;
+  }
+
+  *missed = 0;
+  if (log->next_seq - *cursor > CHANGE_LOG_SIZE) {
+    *missed = log->next_seq - CHANGE_LOG_SIZE - *cursor;
+    *cursor = log->next_seq - CHANGE_LOG_SIZE;
+  }
+  for (; n < max && *cursor != log->next_seq; n++, (*cursor)++)
+    out[n] = log->events[*cursor & (CHANGE_LOG_SIZE - 1)];
+  pthread_mutex_unlock(&log->lock);
+  return n;
+}
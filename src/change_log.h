@@ -0,0 +1,72 @@
+#ifndef CHANGE_LOG_HEADER
+#define CHANGE_LOG_HEADER
+
+#include <pthread.h>
+
+/** A bounded, in-memory log of the changes made to an airport's schedule.
+ *
+ *  Every change gets the next sequence number and goes into a ring of the
+ *  last `CHANGE_LOG_SIZE` changes. Readers keep their own cursor (the sequence
+ *  number of the next change they want), so any number of them can follow the
+ *  log at their own pace without the writer ever waiting for them. A reader
+ *  that falls more than a whole ring behind loses the oldest changes and is
+ *  told how many it missed.
+ *
+ *  Nothing can read a change made before the first reader subscribed, so the
+ *  ring itself is only allocated then: an airport nobody watches pays for a
+ *  sequence counter and nothing else.
+ */
+
+#define CHANGE_LOG_SIZE 1024 /* Changes kept (power of two) */
+
+/* Kinds of change. Planes can't be cancelled yet, only moved to another gate. */
+#define CHANGE_SCHEDULED 1   /* a plane was placed at `gate` */
+#define CHANGE_GATES_ADDED 2 /* the airport grew, `gate` is its new gate count */
+#define CHANGE_MOVED 3       /* OPTIMIZE moved a plane from `from_gate` to `gate` */
+
+typedef struct {
+  unsigned long seq; /* Position in the log, starting from 0 */
+  int type;          /* `CHANGE_*` */
+  int gate;
+  int plane_id;
+  int start; /* Index of the first time slot taken */
+  int end;   /* Index of the last time slot taken */
+  int from_gate; /* Where a `CHANGE_MOVED` plane was before */
+} change_event_t;
+
+typedef struct {
+  change_event_t *events; /* `CHANGE_LOG_SIZE` entries, NULL until subscribed to */
+  unsigned long next_seq; /* Sequence number the next change will get */
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} change_log_t;
+
+void change_log_init(change_log_t *log);
+
+/** @brief Adds a change to the log (its `seq` is filled in) and wakes every
+ *         reader waiting for one. Never blocks on readers.
+ */
+void change_log_append(change_log_t *log, change_event_t *ev);
+
+/** @brief Starts a new reader at the end of the log: `*cursor` is set to the
+ *         sequence number the next change will get, so the reader only sees
+ *         changes made from now on.
+ *
+ *  @returns 0 on success, -1 if the ring couldn't be allocated.
+ */
+int change_log_subscribe(change_log_t *log, unsigned long *cursor);
+
+/** @brief Copies up to `max` changes starting at `*cursor` (which must have
+ *         come from `change_log_subscribe`) into `out` and
+ *         advances the cursor past them, waiting up to `timeout_ms` (-1 for
+ *         ever) if there are none yet.
+ *
+ *  @param missed Set to the number of changes that were dropped from the log
+ *                before this reader got to them (the cursor skips over them).
+ *
+ *  @returns The number of changes copied, 0 if the timeout expired first.
+ */
+int change_log_read(change_log_t *log, unsigned long *cursor, change_event_t *out, int max,
+                    unsigned long *missed, int timeout_ms);
+
+#endif
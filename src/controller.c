@@ -1,27 +1,69 @@
+#include <dirent.h>
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "affinity.h"
 #include "airport.h"
 #include "network_utils.h"
+#include "read_cache.h"
+#include "relay.h"
+#include "shm_ring.h"
+#include "trace.h"
+#ifdef USE_IO_URING
+#include "uring_io.h"
+#endif
 
 #define PORT_STRLEN 6
 #define DEFAULT_PORTNUM 1024
 #define MIN_PORTNUM 1024
 #define MAX_PORTNUM 65535
 
+#define DEFAULT_TIMEOUT_MS 2000 /* connect/read timeout when talking to airports */
+#define DEFAULT_RETRIES 2       /* extra attempts for read-only requests */
+#define BREAKER_THRESHOLD 3     /* consecutive failures before we stop trying */
+#define PROBE_INTERVAL_MS 250   /* how often unhealthy airports get probed */
+#define DEFAULT_SPARE_AIRPORTS 16 /* room for airports added with ADD_AIRPORT */
+#define STARTUP_BATCH 256         /* airport ports bound at once during startup */
+#define STARTUP_TIMEOUT_MS 30000  /* longest we wait for airports to report ready */
+#define WATCH_SEND_TIMEOUT_MS 5000 /* WATCH clients that stop reading get dropped */
+#define MAX_FRONT_ENDS 64          /* threads accepting clients (-f) */
+#define MAX_REPLICAS 8             /* read replicas per airport (-y) */
+
+/* Outcomes of a single attempt at forwarding a request. */
+#define FWD_OK 0       /* the whole reply was relayed */
+#define FWD_NO_REPLY 1 /* nothing was sent to the client, safe to retry */
+#define FWD_BROKEN 2   /* part of a reply was relayed before it failed */
+
 /** Struct that contains information associated with each airport node. */
 typedef struct airport_node_info {
   int id;    /* Airport identifier */
   int port;  /* Port num associated with this airport's listening socket */
   pid_t pid; /* PID of the child process for this airport. */
+  shm_channel_t *chan; /* Shared-memory channel, if using that transport */
+  int shm_stale;       /* replies on `chan` still owed for timed out requests */
+  int failures;        /* consecutive failed requests, guarded by breaker_lock */
+  int breaker_open;    /* 1 while requests fail fast, guarded by breaker_lock */
+  int retired;         /* 1 once the airport has been retired, guarded by breaker_lock */
+  int started;         /* 0 until its node has been forked (see -L) */
+  pthread_mutex_t chan_lock; /* held by the front-end using `chan` */
+  struct airport_node_info *replicas; /* read-only copies of this airport (-y) */
+  int num_replicas;                   /* how many of them were started */
+  unsigned next_replica;              /* where the next read goes, round robin */
+  unsigned long writes; /* bumped as each write to the airport starts and ends (-c) */
+  int writing;          /* writes to the airport in flight (-c) */
 } node_info_t;
 
 /** Struct that contains parameters for the controller node and ATC network as
@@ -29,45 +71,630 @@ typedef struct airport_node_info {
 typedef struct controller_params_t {
   int listenfd;               /* file descriptor of the controller listening socket */
   int portnum;                /* port number used to connect to the controller */
-  int num_airports;           /* number of airports to create */
+  int num_airports;           /* number of airports created so far */
+  int max_airports;           /* number of airports there is room for */
+  int num_hosts;              /* processes the startup airports share, 0 for one each */
+  int lazy;                   /* only start an airport's node on its first request */
+  char *ready_file;           /* created once every startup airport is serving */
+  char *trace_file;           /* where every client request is recorded (-T) */
   int *gate_counts;           /* array containing the number of gates in each airport */
   node_info_t *airport_nodes; /* array of info associated with each airport */
+  int use_shm;                /* talk to airports over shared memory, not TCP */
+  int num_front_ends;         /* threads accepting clients, each on its own socket */
+  int replicas_per_airport;   /* read-only replicas started with each airport */
+  int timeout_ms;             /* connect/read timeout for airport requests */
+  int retries;                /* extra attempts for PLANE_STATUS/TIME_STATUS */
+  int pin_slots;              /* processes the -a CPUs are shared between, 0 to not pin */
+  int optimize_ms;            /* how often every airport is sent OPTIMIZE, 0 for never (-O) */
 } controller_params_t;
 
 controller_params_t ATC_INFO;
 
-static void forward_request_to_airport(int connfd, int airport_num, char *request) {
-  // check if valid airport
-  if (airport_num < 0 || airport_num >= ATC_INFO.num_airports) {
-    send_response(connfd, "Error: Airport %d does not exist\n", airport_num);
+/* The probe thread and the server loops both update the circuit breakers. */
+static pthread_mutex_t breaker_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Front-ends only read the node table when routing. Changing it (adding an
+ * airport, starting a -L node) is done under this lock. */
+static pthread_mutex_t nodes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A reply collected for the read cache instead of going straight to the
+ * client. */
+typedef struct {
+  char *data;
+  size_t len, cap;
+} capture_t;
+
+static int capture_append(capture_t *capture, const char *buf, size_t n) {
+  if (capture->len + n > capture->cap) {
+    size_t cap = (capture->len + n) * 2;
+    char *grown = realloc(capture->data, cap);
+    if (!grown)
+      return -1;
+    capture->data = grown;
+    capture->cap = cap;
+  }
+  memcpy(capture->data + capture->len, buf, n);
+  capture->len += n;
+  return 0;
+}
+
+/* Pipe used to splice airport replies to clients, one per front-end. */
+static __thread int RELAY_PIPE[2] = {-1, -1};
+
+/* Options a client has set on its connection with SESSION. Each front-end
+ * keeps them for the connections it serves, indexed by connfd, and clears a
+ * connection's entry once it's done with it. */
+typedef struct {
+  int read_your_writes; /* reads of an airport written to go to its primary */
+  unsigned char *wrote; /* which airports have been written to, if so */
+  unsigned long trace_conn; /* the connection's number in the trace, 0 until it has one */
+} session_t;
+
+static __thread session_t *SESSIONS = NULL;
+static __thread int NUM_SESSIONS = 0;
+
+static session_t *get_session(int connfd) {
+  if (connfd < 0) // the controller's own requests, see optimize_thread
+    return NULL;
+  if (connfd >= NUM_SESSIONS) {
+    int n = connfd + 64;
+    session_t *grown = realloc(SESSIONS, sizeof(session_t) * (size_t)n);
+    if (!grown)
+      return NULL;
+    memset(grown + NUM_SESSIONS, 0, sizeof(session_t) * (size_t)(n - NUM_SESSIONS));
+    SESSIONS = grown;
+    NUM_SESSIONS = n;
+  }
+  return &SESSIONS[connfd];
+}
+
+static void end_session(int connfd) {
+  if (connfd < NUM_SESSIONS) {
+    free(SESSIONS[connfd].wrote);
+    memset(&SESSIONS[connfd], 0, sizeof(session_t));
+  }
+}
+
+/* The relay pipe may be left holding part of a reply after a failed splice, so
+ * it gets swapped out for an empty one. */
+static void reset_relay_pipe(void) {
+  if (RELAY_PIPE[0] >= 0) {
+    close(RELAY_PIPE[0]);
+    close(RELAY_PIPE[1]);
+  }
+  if (pipe(RELAY_PIPE) < 0) {
+    perror("[Controller] pipe");
+    exit(1);
+  }
+}
+
+/* Closes every descriptor but stdio and `keep` in a freshly forked node. One
+ * forked while the controller is serving would otherwise hold on to client
+ * connections, and the client would never see them close. */
+static void close_inherited_fds(int *keep, int n) {
+  int fds[1024], count = 0;
+  struct dirent *ent;
+  DIR *dir = opendir("/proc/self/fd");
+  if (!dir)
     return;
+  while ((ent = readdir(dir)) != NULL && count < 1024) {
+    int fd = atoi(ent->d_name), wanted = fd <= STDERR_FILENO || fd == dirfd(dir) ||
+                                         fd == AIRPORT_CONFIG.ready_fd;
+    for (int i = 0; i < n; i++)
+      wanted |= fd == keep[i];
+    if (ent->d_name[0] != '.' && !wanted)
+      fds[count++] = fd;
   }
+  closedir(dir);
+  for (int i = 0; i < count; i++)
+    close(fds[i]);
+}
+
+/* Called in a node that was just forked, before it allocates anything, so
+ * its gates are first touched on its own NUMA node. Returns the first CPU it
+ * was pinned to, or -1. */
+static int pin_node(int slot) {
+  return ATC_INFO.pin_slots ? affinity_pin(slot, ATC_INFO.pin_slots) : -1;
+}
 
+/* Starts the read replicas of `node`, whose primary has just been forked.
+ * Their ports come after the ports of every possible primary. Returns the
+ * number started. */
+static int spawn_replicas(node_info_t *node, int num_gates) {
+  char port_str[PORT_STRLEN];
+  int lfd;
+  pid_t pid;
+
+  node->num_replicas = 0;
+  for (int r = 0; r < ATC_INFO.replicas_per_airport; r++) {
+    node_info_t *replica = &node->replicas[r];
+    replica->id = node->id;
+    replica->port = ATC_INFO.portnum + 1 + ATC_INFO.max_airports +
+                    node->id * ATC_INFO.replicas_per_airport + r;
+    snprintf(port_str, PORT_STRLEN, "%d", replica->port);
+    if ((lfd = open_listenfd(port_str)) < 0) {
+      perror("open_listenfd");
+      continue;
+    }
+    if ((pid = fork()) == 0) {
+      close_inherited_fds(&lfd, 1);
+      affinity_steer(lfd, pin_node(node->id));
+      initialise_replica(node->id, num_gates, lfd, node->port);
+      exit(0);
+    }
+    close(lfd);
+    if (pid < 0) {
+      perror("fork");
+      continue;
+    }
+    replica->pid = pid;
+    __atomic_store_n(&replica->started, 1, __ATOMIC_RELEASE);
+    node->num_replicas++;
+    LOG("[Controller] Airport %d replica %d assigned port %s\n", node->id, r, port_str);
+  }
+  return node->num_replicas;
+}
+
+/* Starts the node for airport `idx` (at startup, on its first request with
+ * -L, or for ADD_AIRPORT), along with its replicas. Its port is always
+ * `portnum + 1 + idx`, parse_args has kept those free; `lfd` is a socket
+ * already listening on it, or -1 to open one here. Returns -1 if the airport
+ * couldn't be started. */
+static int spawn_airport(int idx, int num_gates, int lfd) {
+  char port_str[PORT_STRLEN];
+  node_info_t *node = &ATC_INFO.airport_nodes[idx];
+  pid_t pid;
+
+  node->id = idx;
+  if (ATC_INFO.use_shm) {
+    pthread_mutex_init(&node->chan_lock, NULL);
+    if ((node->chan = shm_channel_create()) == NULL) {
+      perror("shm_channel_create");
+      return -1;
+    }
+    if ((pid = fork()) == 0) {
+      int keep[] = {node->chan->request.data_efd, node->chan->request.space_efd,
+                    node->chan->response.data_efd, node->chan->response.space_efd};
+      close_inherited_fds(keep, 4);
+      pin_node(idx);
+      initialise_shm_node(idx, num_gates, node->chan);
+      exit(0);
+    } else if (pid < 0) {
+      perror("fork");
+      return -1;
+    }
+    node->pid = pid;
+    __atomic_store_n(&node->started, 1, __ATOMIC_RELEASE);
+    LOG("[Controller] Airport %d using shared memory\n", idx);
+    return 0;
+  }
+  node->port = ATC_INFO.portnum + 1 + idx;
+  snprintf(port_str, PORT_STRLEN, "%d", node->port);
+  if (lfd < 0 && (lfd = open_listenfd(port_str)) < 0) {
+    perror("open_listenfd");
+    return -1;
+  }
+  if ((pid = fork()) == 0) {
+    close_inherited_fds(&lfd, 1);
+    affinity_steer(lfd, pin_node(idx));
+    initialise_node(idx, num_gates, lfd);
+    exit(0);
+  } else if (pid < 0) {
+    perror("fork");
+    close(lfd);
+    return -1;
+  }
+  node->pid = pid;
+  LOG("[Controller] Airport %d assigned port %s\n", idx, port_str);
+  close(lfd);
+  spawn_replicas(node, num_gates);
+  __atomic_store_n(&node->started, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Makes sure a node is running for `node`, starting it now if it was left
+ * for its first request (-L). Returns -1 if it couldn't be started. */
+static int ensure_started(node_info_t *node) {
+  int ret = 0;
+  if (__atomic_load_n(&node->started, __ATOMIC_ACQUIRE))
+    return 0;
+  // two front-ends may both get an airport's first request
+  pthread_mutex_lock(&nodes_lock);
+  if (!node->started)
+    ret = spawn_airport((int)(node - ATC_INFO.airport_nodes),
+                        ATC_INFO.gate_counts[node - ATC_INFO.airport_nodes], -1);
+  pthread_mutex_unlock(&nodes_lock);
+  return ret;
+}
+
+/* Number of airports requests can be routed to. New ones are published with a
+ * release store once their node is set up. */
+static int known_airports(void) {
+  return __atomic_load_n(&ATC_INFO.num_airports, __ATOMIC_ACQUIRE);
+}
+
+// same order, different delivery van: hand it over through the shared rings
+static int forward_request_over_shm(int connfd, node_info_t *node, char *request,
+                                    capture_t *capture) {
+  shm_channel_t *chan = node->chan;
+  char response[SHM_RECORD_DATA];
+  ssize_t response_n;
+  int end = 0, relayed = 0;
+  if (capture)
+    capture->len = 0;
+
+  // throw away any late replies to requests we already gave up on
+  while (node->shm_stale > 0) {
+    if (shm_ring_read(&chan->response, response, sizeof(response), &end, 0) < 0)
+      return FWD_NO_REPLY;
+    if (end)
+      node->shm_stale--;
+  }
+
+  // an airport that stopped reading leaves the ring full, the breaker counts
+  // that like any other missing reply
+  if (shm_ring_write(&chan->request, request, strlen(request), 1, ATC_INFO.timeout_ms) < 0)
+    return FWD_NO_REPLY;
+  end = 0;
+  while (!end) {
+    response_n = shm_ring_read(&chan->response, response, sizeof(response), &end,
+                               ATC_INFO.timeout_ms);
+    if (response_n < 0) {
+      node->shm_stale++;
+      return relayed ? FWD_BROKEN : FWD_NO_REPLY;
+    }
+    if (response_n > 0 && capture) {
+      if (capture_append(capture, response, (size_t)response_n) < 0) {
+        node->shm_stale += !end;
+        return FWD_NO_REPLY;
+      }
+    } else if (response_n > 0) {
+      rio_writen(connfd, response, (size_t)response_n);
+      relayed = 1;
+    }
+  }
+  return FWD_OK;
+}
+
+static int forward_request_over_tcp(int connfd, node_info_t *node, char *request,
+                                    capture_t *capture) {
+  if (capture)
+    capture->len = 0;
   // confirm order with customer
-  int port = ATC_INFO.airport_nodes[airport_num].port;
   char airport_port_str[PORT_STRLEN];
-  snprintf(airport_port_str, PORT_STRLEN, "%d", port);
+  snprintf(airport_port_str, PORT_STRLEN, "%d", node->port);
 
   // confirm/establish address with customer
-  int airportfd = open_clientfd("localhost", airport_port_str);
-  if (airportfd < 0 || airport_num >= ATC_INFO.num_airports) {
-    fprintf(stderr, "[Controller] Failed to connect to airport %d\n", airport_num);
+  int airportfd = open_clientfd_timeout("localhost", airport_port_str, ATC_INFO.timeout_ms);
+  if (airportfd < 0)
+    return FWD_NO_REPLY;
+
+  // if the kitchen is on fire we stop waiting eventually
+  struct timeval tv = {ATC_INFO.timeout_ms / 1000, (ATC_INFO.timeout_ms % 1000) * 1000};
+  setsockopt(airportfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  // package and give order to ubereats guy
+  if (rio_writen(airportfd, request, strlen(request)) < 0 ||
+      rio_wait(airportfd, POLLIN, ATC_INFO.timeout_ms) <= 0) {
+    close(airportfd);
+    return FWD_NO_REPLY;
+  }
+
+  // the cache has to see the reply, nothing reaches the client until it's all in
+  int ret = FWD_OK;
+  if (capture) {
+    char buf[MAXBUF];
+    ssize_t n;
+    while ((n = read(airportfd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+      if (n > 0 && capture_append(capture, buf, (size_t)n) < 0)
+        break;
+    if (n != 0)
+      ret = FWD_NO_REPLY;
+    close(airportfd);
+    return ret;
+  }
+  // the reply goes straight back to the customer, we never need to look inside
+  if (rio_splice(airportfd, connfd, RELAY_PIPE) < 0) {
+    fprintf(stderr, "[Controller] Relay from airport %d failed: %s\n",
+            node->id, strerror(errno));
+    reset_relay_pipe();
+    ret = FWD_BROKEN;
+  }
+  close(airportfd);
+  return ret;
+}
+
+/* For log messages: replicas live outside the primaries' table. */
+static const char *node_kind(node_info_t *node) {
+  int primary = node >= ATC_INFO.airport_nodes &&
+                node < ATC_INFO.airport_nodes + ATC_INFO.max_airports;
+  return primary ? "" : " replica";
+}
+
+/* Records the outcome of a request to `node`, opening its breaker after too
+ * many failures in a row. */
+static void breaker_record(node_info_t *node, int ok) {
+  pthread_mutex_lock(&breaker_lock);
+  if (ok) {
+    node->failures = 0;
+  } else if (++node->failures >= BREAKER_THRESHOLD && !node->breaker_open) {
+    node->breaker_open = 1;
+    fprintf(stderr, "[Controller] Airport %d%s marked unavailable\n", node->id,
+            node_kind(node));
+  }
+  pthread_mutex_unlock(&breaker_lock);
+}
+
+static int breaker_is_open(node_info_t *node) {
+  pthread_mutex_lock(&breaker_lock);
+  int open = node->breaker_open;
+  pthread_mutex_unlock(&breaker_lock);
+  return open;
+}
+
+static int node_is_retired(node_info_t *node) {
+  pthread_mutex_lock(&breaker_lock);
+  int retired = node->retired;
+  pthread_mutex_unlock(&breaker_lock);
+  return retired;
+}
+
+/* Checks whether an airport with an open breaker looks healthy again, by
+ * asking it something cheap and waiting for the answer: a hung airport still
+ * completes the handshake, and its process is still there. */
+static int probe_airport(node_info_t *node) {
+  char port_str[PORT_STRLEN], probe[MAXLINE];
+  int fd;
+  snprintf(probe, sizeof(probe), "PLANE_STATUS %d -1\n", node->id);
+  if (ATC_INFO.use_shm) {
+    if (node->pid <= 0 || kill(node->pid, 0) != 0)
+      return 0;
+    // the rings are used like a front-end would, under the channel lock, and
+    // an answer that comes too late is thrown away like any other
+    capture_t capture = {NULL, 0, 0};
+    pthread_mutex_lock(&node->chan_lock);
+    int ok = forward_request_over_shm(-1, node, probe, &capture) == FWD_OK;
+    pthread_mutex_unlock(&node->chan_lock);
+    free(capture.data);
+    return ok;
+  }
+  snprintf(port_str, PORT_STRLEN, "%d", node->port);
+  if ((fd = open_clientfd_timeout("localhost", port_str, ATC_INFO.timeout_ms)) < 0)
+    return 0;
+  int ok = rio_writen(fd, probe, strlen(probe)) > 0 &&
+           rio_wait(fd, POLLIN, ATC_INFO.timeout_ms) > 0;
+  close(fd);
+  return ok;
+}
+
+/* Closes the breaker of `node` if it's open and the node answers again. */
+static void probe_node(node_info_t *node) {
+  if (!breaker_is_open(node) || !probe_airport(node))
+    return;
+  pthread_mutex_lock(&breaker_lock);
+  node->breaker_open = 0;
+  node->failures = 0;
+  pthread_mutex_unlock(&breaker_lock);
+  fprintf(stderr, "[Controller] Airport %d%s available again\n", node->id, node_kind(node));
+}
+
+// keep knocking on the doors of the airports that stopped answering
+static void *probe_thread(void *arg) {
+  node_info_t *node;
+  while (1) {
+    usleep(PROBE_INTERVAL_MS * 1000);
+    int num_airports = known_airports();
+    for (int idx = 0; idx < num_airports; idx++) {
+      node = &ATC_INFO.airport_nodes[idx];
+      if (node_is_retired(node))
+        continue;
+      probe_node(node);
+      for (int r = 0; r < ATC_INFO.replicas_per_airport; r++)
+        if (__atomic_load_n(&node->replicas[r].started, __ATOMIC_ACQUIRE))
+          probe_node(&node->replicas[r]);
+    }
+  }
+  return NULL;
+}
+
+/* Picks the replica of `node` the next read should go to, skipping any that
+ * aren't answering. Returns NULL if there's none to use. */
+static node_info_t *pick_replica(node_info_t *node) {
+  for (int i = 0; i < ATC_INFO.replicas_per_airport; i++) {
+    unsigned r = __atomic_fetch_add(&node->next_replica, 1, __ATOMIC_RELAXED) %
+                 (unsigned)ATC_INFO.replicas_per_airport;
+    node_info_t *replica = &node->replicas[r];
+    if (__atomic_load_n(&replica->started, __ATOMIC_ACQUIRE) && !breaker_is_open(replica))
+      return replica;
+  }
+  return NULL;
+}
+
+/* Forwards `request` to an airport and relays its reply to the client, or
+ * collects it in `capture` if that isn't NULL (errors the controller comes up
+ * with itself still go straight to the client). Requests marked `read_only`
+ * are retried if the airport gave no reply, and are served by one of its
+ * replicas when it has any (unless the client asked to read its own writes
+ * and has written to this airport). Collected replies always come from the
+ * primary: the read cache keeps them as current, and a replica may be
+ * behind. */
+static void route_request(int connfd, int airport_num, char *request, int read_only,
+                          capture_t *capture) {
+  // check if valid airport
+  if (airport_num < 0 || airport_num >= known_airports()) {
+    send_response(connfd, "Error: Airport %d does not exist\n", airport_num);
+    return;
+  }
+
+  node_info_t *node = &ATC_INFO.airport_nodes[airport_num];
+  if (node_is_retired(node)) {
+    send_response(connfd, "Error: Airport %d has been retired\n", airport_num);
+    return;
+  }
+  if (ensure_started(node) < 0) {
+    send_response(connfd, "Error: Could not start airport %d\n", airport_num);
+    return;
+  }
+
+  int ret = FWD_NO_REPLY;
+  session_t *session = get_session(connfd);
+  int own_writes = session && session->read_your_writes && session->wrote[airport_num];
+  node_info_t *replica;
+  if (read_only && !own_writes && !capture && (replica = pick_replica(node)) != NULL) {
+    // one go at the replica, the primary is the retry
+    ret = forward_request_over_tcp(connfd, replica, request, capture);
+    breaker_record(replica, ret == FWD_OK);
+    if (ret != FWD_NO_REPLY)
+      return;
+  }
+  if (!read_only && session && session->read_your_writes)
+    session->wrote[airport_num] = 1;
+
+  if (breaker_is_open(node)) {
+    send_response(connfd, "Error: Airport %d unavailable\n", airport_num);
+    return;
+  }
+  // cached reads are only good until the next write starts (see
+  // forward_cached_read)
+  if (!read_only) {
+    __atomic_fetch_add(&node->writing, 1, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&node->writes, 1, __ATOMIC_SEQ_CST);
+  }
+  int attempts = read_only ? 1 + ATC_INFO.retries : 1;
+  for (int i = 0; i < attempts && ret == FWD_NO_REPLY; i++) {
+    if (ATC_INFO.use_shm) {
+      // the rings have a single producer and consumer on each side
+      pthread_mutex_lock(&node->chan_lock);
+      ret = forward_request_over_shm(connfd, node, request, capture);
+      pthread_mutex_unlock(&node->chan_lock);
+    } else
+      ret = forward_request_over_tcp(connfd, node, request, capture);
+  }
+  if (!read_only) {
+    __atomic_fetch_add(&node->writes, 1, __ATOMIC_SEQ_CST);
+    __atomic_fetch_sub(&node->writing, 1, __ATOMIC_SEQ_CST);
+  }
+
+  breaker_record(node, ret == FWD_OK);
+  if (ret == FWD_NO_REPLY) {
+    fprintf(stderr, "[Controller] Failed to get a reply from airport %d\n", airport_num);
     send_response(connfd, "Error: Could not connect to airport %d\n", airport_num);
+  }
+}
+
+static void forward_request_to_airport(int connfd, int airport_num, char *request,
+                                       int read_only) {
+  route_request(connfd, airport_num, request, read_only, NULL);
+}
+
+/* Sends every running airport an OPTIMIZE each -O ms. They go through
+ * route_request like any client's write, so the read cache and read-your-
+ * writes sessions know the planes may have moved. There's no client, the
+ * reply is collected and thrown away. */
+static void *optimize_thread(void *arg) {
+  char request[MAXLINE];
+  struct timespec interval = {ATC_INFO.optimize_ms / 1000,
+                              (ATC_INFO.optimize_ms % 1000) * 1000000L};
+  while (1) {
+    nanosleep(&interval, NULL);
+    int num_airports = known_airports();
+    for (int idx = 0; idx < num_airports; idx++) {
+      node_info_t *node = &ATC_INFO.airport_nodes[idx];
+      // -L airports nobody has asked for yet have nothing to move
+      if (!__atomic_load_n(&node->started, __ATOMIC_ACQUIRE) || node_is_retired(node))
+        continue;
+      capture_t capture = {NULL, 0, 0};
+      snprintf(request, sizeof(request), "OPTIMIZE %d\n", idx);
+      route_request(-1, idx, request, 0, &capture);
+      free(capture.data);
+    }
+  }
+  return NULL;
+}
+
+/* Serves a PLANE_STATUS or TIME_STATUS through the read cache (-c).
+ *
+ * Every write to an airport bumps its `writes` generation when it starts and
+ * again when it's done, and a cached reply is served without going near the
+ * airport for as long as the generation it was filled at is current. Filling
+ * only counts if no write was in flight and the generation didn't move while
+ * the reply was being fetched, so a cached reply never predates a write a
+ * client has already been told about.
+ *
+ * Once the generation has moved on, the request goes to the airport with
+ * `CACHED <version>`. If the part of the airport it reads is still at that
+ * version the reply is just NOT_MODIFIED, and the cached copy is good for the
+ * new generation. */
+static void forward_cached_read(int connfd, int airport_num, char *request) {
+  char key[MAXLINE], line[MAXLINE + 32];
+  unsigned long version = 0, entry_gen, again_version, again_gen;
+  char *reply = NULL;
+  size_t len;
+
+  session_t *session = get_session(connfd);
+  if (airport_num < 0 || airport_num >= known_airports() ||
+      (session && session->read_your_writes && session->wrote[airport_num])) {
+    forward_request_to_airport(connfd, airport_num, request, 1);
     return;
   }
+  node_info_t *node = &ATC_INFO.airport_nodes[airport_num];
 
-  // package and give order to ubereats guy
-  rio_writen(airportfd, request, strlen(request));
+  // the request line, minus its newline, is the key
+  size_t key_len = strcspn(request, "\r\n");
+  memcpy(key, request, key_len);
+  key[key_len] = '\0';
 
-  // confirm response of delivery from ubereats guy
-  rio_t airport_rio;
-  rio_readinitb(&airport_rio, airportfd);
-  char response[MAXLINE];
-  ssize_t response_n;
-  while ((response_n = rio_readlineb(&airport_rio, response, MAXLINE)) > 0) {
-    rio_writen(connfd, response, (size_t)response_n);
+  unsigned long gen = __atomic_load_n(&node->writes, __ATOMIC_SEQ_CST);
+  int quiet = __atomic_load_n(&node->writing, __ATOMIC_SEQ_CST) == 0;
+  int cached = read_cache_get(key, &version, &entry_gen, &reply, &len);
+  if (cached && entry_gen == gen && !node_is_retired(node)) {
+    rio_writen(connfd, reply, len);
+    free(reply);
+    return;
   }
-  close(airportfd);
+  free(reply);
+  reply = NULL;
+
+  int line_len;
+  if (cached)
+    line_len = snprintf(line, sizeof(line), "%s CACHED %lu\n", key, version);
+  else
+    line_len = snprintf(line, sizeof(line), "%s CACHED -\n", key);
+  // a request that only just fits without the suffix isn't cached, the
+  // airport would refuse it as too long
+  if (line_len >= REQUEST_MAX) {
+    forward_request_to_airport(connfd, airport_num, request, 1);
+    return;
+  }
+  capture_t capture = {NULL, 0, 0};
+  route_request(connfd, airport_num, line, 1, &capture);
+  if (capture.len == 0) { // an error has already been sent
+    free(capture.data);
+    return;
+  }
+  int fresh = quiet && __atomic_load_n(&node->writes, __ATOMIC_SEQ_CST) == gen;
+
+  char *nl = memchr(capture.data, '\n', capture.len);
+  size_t header = nl ? (size_t)(nl - capture.data) + 1 : 0;
+  if (nl && sscanf(capture.data, "NOT_MODIFIED %lu", &again_version) == 1) {
+    // unless the entry has been replaced since, in which case we ask again
+    if (read_cache_get(key, &version, &again_gen, &reply, &len) && version == again_version) {
+      if (fresh)
+        read_cache_revalidate(key, version, gen);
+      rio_writen(connfd, reply, len);
+      free(reply);
+    } else {
+      free(reply);
+      forward_request_to_airport(connfd, airport_num, request, 1);
+    }
+  } else if (nl && sscanf(capture.data, "VERSION %lu", &again_version) == 1) {
+    if (fresh)
+      read_cache_put(key, again_version, gen, capture.data + header, capture.len - header);
+    rio_writen(connfd, capture.data + header, capture.len - header);
+  } else {
+    rio_writen(connfd, capture.data, capture.len);
+  }
+  free(capture.data);
 }
 
 
@@ -83,7 +710,7 @@ void handle_schedule(int connfd, char *request) {
     send_response(connfd, "Error: Invalid request provided\n");
     return;
   }
-  forward_request_to_airport(connfd, airport_num, request);
+  forward_request_to_airport(connfd, airport_num, request, 0);
 }
 
 // plane go tbrrrrrr
@@ -98,7 +725,10 @@ static void handle_plane_status(int connfd, char *request) {
     send_response(connfd, "Error: Invalid request provided\n");
     return;
   }
-  forward_request_to_airport(connfd, airport_num, request);
+  if (read_cache_enabled())
+    forward_cached_read(connfd, airport_num, request);
+  else
+    forward_request_to_airport(connfd, airport_num, request, 1);
 }
 
 // time required to pickup order
@@ -111,16 +741,501 @@ static void handle_time_status(int connfd, char *request) {
     send_response(connfd, "Error: Invalid request provided\n");
     return;
   }
-  forward_request_to_airport(connfd, airport_num, request);
+  if (read_cache_enabled())
+    forward_cached_read(connfd, airport_num, request);
+  else
+    forward_request_to_airport(connfd, airport_num, request, 1);
+}
+
+// TIME_STATUS over a range of gates, in runs
+static void handle_time_range(int connfd, char *request) {
+  char command[MAXLINE];
+  int airport_num, first_gate, last_gate, start_idx, duration;
+  int args_n = sscanf(request, "%s %d %d %d %d %d", command, &airport_num, &first_gate,
+                      &last_gate, &start_idx, &duration);
+  if (args_n != 6) {
+    send_response(connfd, "Error: Invalid request provided\n");
+    return;
+  }
+  forward_request_to_airport(connfd, airport_num, request, 1);
 }
 
+// which gates are free all the way through this window
+static void handle_gates_free(int connfd, char *request) {
+  char command[MAXLINE];
+  int airport_num, start_idx, duration;
+  int args_n = sscanf(request, "%s %d %d %d", command, &airport_num, &start_idx, &duration);
+  if (args_n != 4) {
+    send_response(connfd, "Error: Invalid request provided\n");
+    return;
+  }
+  forward_request_to_airport(connfd, airport_num, request, 1);
+}
 
-/** @brief The main server loop of the controller.
-*
- *  @todo  Implement this function!
+// whole airport in one go, or every airport one after the other with ALL
+static void handle_dump(int connfd, char *request) {
+  char command[MAXLINE], target[MAXLINE];
+  char per_airport[MAXLINE];
+  int airport_num, rest = 0;
+  int args_n = sscanf(request, "%s %s%n", command, target, &rest);
+  if (args_n < 2) {
+    send_response(connfd, "Error: Invalid request provided\n");
+    return;
+  }
+  if (strcmp(target, "ALL") != 0) {
+    if (sscanf(target, "%d", &airport_num) != 1) {
+      send_response(connfd, "Error: Invalid request provided\n");
+      return;
+    }
+    forward_request_to_airport(connfd, airport_num, request, 1);
+    return;
+  }
+  // each airport snapshots itself, so this is consistent per airport only
+  int num_airports = known_airports();
+  for (int i = 0; i < num_airports; i++) {
+    if (node_is_retired(&ATC_INFO.airport_nodes[i]))
+      continue;
+    // the format and a DEADLINE go along as they are
+    snprintf(per_airport, MAXLINE, "DUMP %d%s", i, request + rest);
+    forward_request_to_airport(connfd, i, per_airport, 1);
+  }
+}
+
+// one WATCH client and the airports it's listening to
+typedef struct {
+  int connfd;
+  int num_airports;
+  int *airportfds;
+  rio_t *rios;
+} watch_relay_t;
+
+/* Copies event lines from every watched airport to the client until the
+ * client leaves or all of the airports stop. Runs detached, so the server
+ * loop can get back to normal requests. */
+static void *watch_relay_thread(void *arg) {
+  watch_relay_t *wr = arg;
+  int n = wr->num_airports, live = n;
+  struct pollfd *pfds = calloc((size_t)n + 1, sizeof(struct pollfd));
+  char line[MAXLINE];
+
+  pfds[0].fd = wr->connfd;
+  pfds[0].events = POLLIN;
+  for (int i = 0; i < n; i++) {
+    pfds[i + 1].fd = wr->airportfds[i];
+    pfds[i + 1].events = POLLIN;
+  }
+
+  while (live > 0) {
+    if (poll(pfds, (nfds_t)n + 1, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    // nothing else is expected from the client. Once it has shut its end
+    // (`nc` does that after sending the request) we stop listening to it and
+    // only notice it's gone when a write fails.
+    if (pfds[0].revents && recv(wr->connfd, line, MAXLINE, 0) <= 0)
+      pfds[0].fd = -1;
+    for (int i = 0; i < n; i++) {
+      if (pfds[i + 1].fd < 0 || !pfds[i + 1].revents)
+        continue;
+      // whole lines only, so events from different airports never interleave
+      do {
+        ssize_t len = rio_readlineb(&wr->rios[i], line, MAXLINE);
+        if (len <= 0) {
+          pfds[i + 1].fd = -1;
+          live--;
+          break;
+        }
+        if (rio_writen(wr->connfd, line, (size_t)len) < 0) {
+          live = 0;
+          break;
+        }
+      } while (wr->rios[i].rio_cnt > 0);
+    }
+  }
+
+  for (int i = 0; i < n; i++)
+    close(wr->airportfds[i]);
+  close(wr->connfd);
+  free(pfds);
+  free(wr->airportfds);
+  free(wr->rios);
+  free(wr);
+  return NULL;
+}
+
+/* Subscribes to one airport for a WATCH client. Returns the connection the
+ * events will arrive on, or -1 if the airport said no (its reply has already
+ * been passed on to the client). */
+static int open_watch(int connfd, int airport_num, char *filters, rio_t *rio) {
+  char port_str[PORT_STRLEN], request[MAXLINE], line[MAXLINE];
+  node_info_t *node;
+  int fd;
+
+  if (airport_num < 0 || airport_num >= known_airports()) {
+    send_response(connfd, "Error: Airport %d does not exist\n", airport_num);
+    return -1;
+  }
+  node = &ATC_INFO.airport_nodes[airport_num];
+  if (node_is_retired(node)) {
+    send_response(connfd, "Error: Airport %d has been retired\n", airport_num);
+    return -1;
+  }
+  if (breaker_is_open(node)) {
+    send_response(connfd, "Error: Airport %d unavailable\n", airport_num);
+    return -1;
+  }
+  if (ensure_started(node) < 0) {
+    send_response(connfd, "Error: Could not start airport %d\n", airport_num);
+    return -1;
+  }
+  snprintf(port_str, PORT_STRLEN, "%d", node->port);
+  if ((fd = open_clientfd_timeout("localhost", port_str, ATC_INFO.timeout_ms)) < 0) {
+    send_response(connfd, "Error: Could not connect to airport %d\n", airport_num);
+    return -1;
+  }
+  snprintf(request, MAXLINE, "WATCH %d %s\n", airport_num, filters);
+  rio_readinitb(rio, fd);
+  // the airport answers WATCHING once it's following its change log
+  if (rio_writen(fd, request, strlen(request)) < 0 ||
+      rio_wait(fd, POLLIN, ATC_INFO.timeout_ms) <= 0 ||
+      rio_readlineb(rio, line, MAXLINE) <= 0) {
+    send_response(connfd, "Error: Could not connect to airport %d\n", airport_num);
+    close(fd);
+    return -1;
+  }
+  rio_writen(connfd, line, strlen(line));
+  if (strncmp(line, "WATCHING", 8) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* WATCH <airport|a,b,...|ALL> [GATE <gate>] [PLANE <plane_id>]
+ * Returns 0 if the connection now belongs to a relay thread. */
+static int handle_watch(int connfd, char *request) {
+  char command[MAXLINE], targets[MAXLINE];
+  int offset = 0;
+  if (sscanf(request, "%s %s %n", command, targets, &offset) < 2 || offset == 0) {
+    send_response(connfd, "Error: Invalid request provided\n");
+    return 1;
+  }
+  if (ATC_INFO.use_shm) {
+    send_response(connfd, "Error: WATCH is not available over shared memory\n");
+    return 1;
+  }
+
+  char *filters = request + offset;
+  filters[strcspn(filters, "\r\n")] = '\0';
+  int all = strcmp(targets, "ALL") == 0;
+  int max = all ? known_airports() : 1;
+  for (char *c = targets; *c; c++)
+    max += *c == ',';
+  watch_relay_t *wr = malloc(sizeof(watch_relay_t));
+  wr->connfd = connfd;
+  wr->num_airports = 0;
+  wr->airportfds = malloc(sizeof(int) * (size_t)max);
+  wr->rios = malloc(sizeof(rio_t) * (size_t)max);
+
+  char *saveptr = NULL, *tok = all ? NULL : strtok_r(targets, ",", &saveptr);
+  for (int i = 0; i < max; i++) {
+    int airport_num = i, fd;
+    if (!all) {
+      if (!tok)
+        break;
+      if (sscanf(tok, "%d", &airport_num) != 1)
+        airport_num = -1;
+      tok = strtok_r(NULL, ",", &saveptr);
+    } else if (node_is_retired(&ATC_INFO.airport_nodes[i])) {
+      continue;
+    }
+    fd = open_watch(connfd, airport_num, filters, &wr->rios[wr->num_airports]);
+    if (fd >= 0)
+      wr->airportfds[wr->num_airports++] = fd;
+  }
+
+  pthread_t tid;
+  if (wr->num_airports > 0) {
+    struct timeval tv = {WATCH_SEND_TIMEOUT_MS / 1000, (WATCH_SEND_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(connfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (pthread_create(&tid, NULL, watch_relay_thread, wr) == 0) {
+      pthread_detach(tid);
+      return 0;
+    }
+    send_response(connfd, "Error: Cannot start watching\n");
+    for (int i = 0; i < wr->num_airports; i++)
+      close(wr->airportfds[i]);
+  }
+  free(wr->airportfds);
+  free(wr->rios);
+  free(wr);
+  return 1;
+}
+
+// new airport, open for business straight away
+static void handle_add_airport(int connfd, char *request) {
+  char command[MAXLINE];
+  int num_gates, idx, ret;
+  int args_n = sscanf(request, "%s %d", command, &num_gates);
+  if (args_n != 2 || num_gates <= 0 || num_gates > MAX_GATES) {
+    send_response(connfd, "Error: Invalid request provided\n");
+    return;
+  }
+  // the next number is only taken once its node is up, so hold on to it
+  pthread_mutex_lock(&nodes_lock);
+  idx = ATC_INFO.num_airports;
+  if (idx == ATC_INFO.max_airports) {
+    pthread_mutex_unlock(&nodes_lock);
+    send_response(connfd, "Error: No room for more airports (-m %d)\n", ATC_INFO.max_airports);
+    return;
+  }
+  // the node is all set up before other threads can see it
+  if ((ret = spawn_airport(idx, num_gates, -1)) == 0)
+    __atomic_store_n(&ATC_INFO.num_airports, idx + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&nodes_lock);
+
+  if (ret < 0)
+    send_response(connfd, "Error: Could not start airport %d\n", idx);
+  else
+    send_response(connfd, "AIRPORT %d ADDED with %d gates\n", idx, num_gates);
+}
+
+// more gates, the airport grows them without stopping anything
+static void handle_add_gates(int connfd, char *request) {
+  char command[MAXLINE];
+  int airport_num, count;
+  int args_n = sscanf(request, "%s %d %d", command, &airport_num, &count);
+  if (args_n != 3) {
+    send_response(connfd, "Error: Invalid request provided\n");
+    return;
+  }
+  forward_request_to_airport(connfd, airport_num, request, 0);
+}
+
+// moves planes between gates, so it's a write as far as caching goes
+static void handle_optimize(int connfd, char *request) {
+  char command[MAXLINE];
+  int airport_num;
+  int args_n = sscanf(request, "%s %d", command, &airport_num);
+  if (args_n != 2) {
+    send_response(connfd, "Error: Invalid request provided\n");
+    return;
+  }
+  forward_request_to_airport(connfd, airport_num, request, 0);
+}
+
+// closing time: the airport finishes what it has and exits, its id is never reused
+static void handle_retire(int connfd, char *request) {
+  char command[MAXLINE];
+  int airport_num;
+  int args_n = sscanf(request, "%s %d", command, &airport_num);
+  if (args_n != 2) {
+    send_response(connfd, "Error: Invalid request provided\n");
+    return;
+  }
+  // the reply is looked at first: BUSY, an error or no reply at all leave
+  // the airport running, and it has to stay reachable
+  char retired[MAXLINE];
+  int len = snprintf(retired, sizeof(retired), "AIRPORT %d RETIRED\n", airport_num);
+  capture_t capture = {NULL, 0, 0};
+  route_request(connfd, airport_num, request, 0, &capture);
+  if (capture.len == (size_t)len && memcmp(capture.data, retired, capture.len) == 0) {
+    pthread_mutex_lock(&breaker_lock);
+    ATC_INFO.airport_nodes[airport_num].retired = 1;
+    pthread_mutex_unlock(&breaker_lock);
+  }
+  rio_writen(connfd, capture.data, capture.len);
+  free(capture.data);
+}
+
+// how this connection's reads get routed from now on
+static void handle_session(int connfd, char *request) {
+  char command[MAXLINE], mode[MAXLINE];
+  session_t *session = get_session(connfd);
+  if (sscanf(request, "%s %s", command, mode) != 2 || !session) {
+    send_response(connfd, "Error: Invalid request provided\n");
+    return;
+  }
+  if (!strcmp(mode, "READ_YOUR_WRITES")) {
+    if (!session->wrote && !(session->wrote = calloc((size_t)ATC_INFO.max_airports, 1))) {
+      send_response(connfd, "Error: Out of memory\n");
+      return;
+    }
+    session->read_your_writes = 1;
+  } else if (!strcmp(mode, "EVENTUAL")) {
+    session->read_your_writes = 0;
+  } else {
+    send_response(connfd, "Error: Invalid session mode (%s)\n", mode);
+    return;
+  }
+  send_response(connfd, "SESSION %s\n", mode);
+}
+
+/* Starts host process `host`, serving its share of the startup airports on
+ * port `portnum + 1 + host`. Airports are handed out in contiguous blocks,
+ * with the first `num_airports % num_hosts` hosts taking one extra. Returns
+ * -1 if the host couldn't be started. */
+static int spawn_host(int host) {
+  char port_str[PORT_STRLEN];
+  int per_host = ATC_INFO.num_airports / ATC_INFO.num_hosts;
+  int extra = ATC_INFO.num_airports % ATC_INFO.num_hosts;
+  int first = host * per_host + (host < extra ? host : extra);
+  int count = per_host + (host < extra);
+  int port = ATC_INFO.portnum + 1 + host, lfd;
+  pid_t pid;
+
+  snprintf(port_str, PORT_STRLEN, "%d", port);
+  if ((lfd = open_listenfd(port_str)) < 0) {
+    perror("open_listenfd");
+    return -1;
+  }
+  if ((pid = fork()) == 0) {
+    close_inherited_fds(&lfd, 1);
+    affinity_steer(lfd, pin_node(host));
+    initialise_host(first, count, &ATC_INFO.gate_counts[first], lfd);
+    exit(0);
+  } else if (pid < 0) {
+    perror("fork");
+    close(lfd);
+    return -1;
+  }
+  for (int idx = first; idx < first + count; idx++) {
+    ATC_INFO.airport_nodes[idx].id = idx;
+    ATC_INFO.airport_nodes[idx].port = port;
+    ATC_INFO.airport_nodes[idx].pid = pid;
+    ATC_INFO.airport_nodes[idx].started = 1;
+  }
+  fprintf(stderr, "[Controller] Airports %d-%d hosted on port %s\n", first,
+          first + count - 1, port_str);
+  close(lfd);
+  return 0;
+}
+
+/* Forks a node for every startup airport. With TCP their ports are bound
+ * `STARTUP_BATCH` at a time first, which saves an address lookup per airport.
+ * Returns the number of nodes started, replicas included. */
+static int start_airports(void) {
+  int fds[STARTUP_BATCH], started = 0;
+  for (int first = 0; first < ATC_INFO.num_airports; first += STARTUP_BATCH) {
+    int count = ATC_INFO.num_airports - first;
+    if (count > STARTUP_BATCH)
+      count = STARTUP_BATCH;
+    if (!ATC_INFO.use_shm)
+      open_listenfds(ATC_INFO.portnum + 1 + first, count, fds);
+    for (int i = 0; i < count; i++) {
+      if (!ATC_INFO.use_shm && fds[i] < 0) {
+        fprintf(stderr, "[Controller] Could not listen for airport %d\n", first + i);
+        continue;
+      }
+      if (spawn_airport(first + i, ATC_INFO.gate_counts[first + i],
+                        ATC_INFO.use_shm ? -1 : fds[i]) == 0)
+        started += 1 + ATC_INFO.airport_nodes[first + i].num_replicas;
+    }
+  }
+  return started;
+}
+
+/* Waits for `expected` nodes to report in on `ready_pipe` (or to die trying),
+ * then creates the ready file so scripts know they can send requests. */
+static void wait_until_ready(int ready_pipe[2], int expected) {
+  char buf[STARTUP_BATCH], tmp_path[PATH_MAX];
+  int ready = 0;
+  ssize_t n;
+
+  // once every node has closed its copy, the read end hits EOF
+  close(ready_pipe[1]);
+  AIRPORT_CONFIG.ready_fd = -1;
+  while (ready < expected && rio_wait(ready_pipe[0], POLLIN, STARTUP_TIMEOUT_MS) > 0) {
+    if ((n = read(ready_pipe[0], buf, sizeof(buf))) <= 0)
+      break;
+    ready += (int)n;
+  }
+  close(ready_pipe[0]);
+  if (ready < expected)
+    fprintf(stderr, "[Controller] Only %d of %d airport nodes came up\n", ready, expected);
+
+  // written under another name first, so nobody sees it half done
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", ATC_INFO.ready_file);
+  FILE *f = fopen(tmp_path, "w");
+  if (!f || fprintf(f, "READY %d %d\n", ATC_INFO.portnum, ready) < 0 || fclose(f) != 0 ||
+      rename(tmp_path, ATC_INFO.ready_file) < 0)
+    perror("[Controller] ready file");
+}
+
+/* Works out what a client wants from one request line and passes it on.
+ * Returns 0 if something else has taken over the connection, 1 otherwise. */
+static int handle_client_line(int connfd, char *buffer) {
+  // setup to process request like maccas
+  char command[MAXLINE];
+  int args_n;
+  // count!!!
+  args_n = sscanf(buffer, "%s", command);
+  if (trace_enabled()) {
+    session_t *session = get_session(connfd);
+    if (session && !session->trace_conn)
+      session->trace_conn = trace_new_connection();
+    trace_request(session ? session->trace_conn : 0, buffer);
+  }
+  // error conditon figure it out later
+  if (args_n < 1) {
+    send_response(connfd, "Error: Invalid request provided\n");
+    return 1;
+  }
+  // self explanitory | might have to change `!` to `== 0`
+  if (!strcmp(command, "SCHEDULE")) {
+    handle_schedule(connfd, buffer);
+  } else if (!strcmp(command, "PLANE_STATUS")) {
+    handle_plane_status(connfd, buffer);
+  } else if (!strcmp(command, "TIME_STATUS")) {
+    handle_time_status(connfd, buffer);
+  } else if (!strcmp(command, "TIME_RANGE")) {
+    handle_time_range(connfd, buffer);
+  } else if (!strcmp(command, "GATES_FREE")) {
+    handle_gates_free(connfd, buffer);
+  } else if (!strcmp(command, "DUMP")) {
+    handle_dump(connfd, buffer);
+  } else if (!strcmp(command, "WATCH")) {
+    return handle_watch(connfd, buffer);
+  } else if (!strcmp(command, "ADD_AIRPORT")) {
+    handle_add_airport(connfd, buffer);
+  } else if (!strcmp(command, "ADD_GATES")) {
+    handle_add_gates(connfd, buffer);
+  } else if (!strcmp(command, "OPTIMIZE")) {
+    handle_optimize(connfd, buffer);
+  } else if (!strcmp(command, "RETIRE")) {
+    handle_retire(connfd, buffer);
+  } else if (!strcmp(command, "SESSION")) {
+    handle_session(connfd, buffer);
+  } else {
+    send_response(connfd, "Error: Invalid request provided\n");
+  }
+  return 1;
+}
+
+#ifdef USE_IO_URING
+static int controller_on_line(int connfd, char *line, void *arg) {
+  int keep = handle_client_line(connfd, line);
+  if (!keep)
+    end_session(connfd);
+  return keep;
+}
+
+static void controller_on_close(int connfd, void *arg) {
+  end_session(connfd);
+}
+#endif
+
+/** @brief The main server loop of the controller. Every front-end runs one
+ *         on its own listening socket.
  */
-void controller_server_loop(void) {
-  int listenfd = ATC_INFO.listenfd;
+void controller_server_loop(int listenfd) {
+#ifdef USE_IO_URING
+  // only comes back if this kernel won't give us a ring
+  uring_serve(listenfd, controller_on_line, controller_on_close, NULL);
+  fprintf(stderr, "[Controller] io_uring unavailable, using blocking I/O\n");
+#endif
   while (1) {
     /* listen to client request
      * when valid request send to airport node if availible
@@ -143,35 +1258,24 @@ void controller_server_loop(void) {
     rio_t rio;
     rio_readinitb(&rio, connfd);
     // listen and read all the time (we studious like that)
-    while (1) {
+    int keep = 1;
+    while (keep) {
       size_t n = rio_readlineb(&rio, buffer, MAXLINE);
       if (0 >= n) break;
-
-      // setup to process request like maccas
-      char command[MAXLINE];
-      int args_n;
-      // count!!!
-      args_n = sscanf(buffer, "%s", command);
-      // error conditon figure it out later
-      if (args_n < 1) {
-        send_response(connfd, "Error: Invalid request provided\n");
-        continue;
-      }
-      // self explanitory | might have to change `!` to `== 0`
-      if (!strcmp(command, "SCHEDULE")) {
-        handle_schedule(connfd, buffer);
-      } else if (!strcmp(command, "PLANE_STATUS")) {
-        handle_plane_status(connfd, buffer);
-      } else if (!strcmp(command, "TIME_STATUS")) {
-        handle_time_status(connfd, buffer);
-      } else {
-        send_response(connfd, "Error: Invalid request provided\n");
-      }
+      keep = handle_client_line(connfd, buffer);
     }
-    close(connfd);
+    end_session(connfd);
+    if (keep)
+      close(connfd);
   }
 }
 
+static void *front_end_thread(void *arg) {
+  reset_relay_pipe();
+  controller_server_loop((int)(intptr_t)arg);
+  return NULL;
+}
+
 /** @brief A handler for reaping child processes (individual airport nodes).
  *         It may be helpful to set a breakpoint here when trying to debug
  *         issues that cause your airport nodes to crash.
@@ -192,49 +1296,97 @@ void sigchld_handler(int sig) {
  */
 void initialise_network(void) {
   char port_str[PORT_STRLEN];
-  int num_airports = ATC_INFO.num_airports;
-  int lfd, idx, port_num = ATC_INFO.portnum;
-  node_info_t *node;
-  pid_t pid;
+  int idx, port_num = ATC_INFO.portnum;
 
   snprintf(port_str, PORT_STRLEN, "%d", port_num);
-  if ((ATC_INFO.listenfd = open_listenfd(port_str)) < 0) {
-    perror("[Controller] open_listenfd");
-    exit(1);
+  // with several front-ends each gets its own socket on the port, and the
+  // kernel shares connections out between them
+  int *front_end_fds = malloc(sizeof(int) * (size_t)ATC_INFO.num_front_ends);
+  for (idx = 0; idx < ATC_INFO.num_front_ends; idx++) {
+    front_end_fds[idx] = ATC_INFO.num_front_ends > 1 ? open_reuseport_listenfd(port_str)
+                                                     : open_listenfd(port_str);
+    if (front_end_fds[idx] < 0) {
+      perror("[Controller] open_listenfd");
+      exit(1);
+    }
   }
+  ATC_INFO.listenfd = front_end_fds[0];
 
-  for (idx = 0; idx < num_airports; idx++) {
-    node = &ATC_INFO.airport_nodes[idx];
-    node->id = idx;
-    node->port = ++port_num;
-    snprintf(port_str, PORT_STRLEN, "%d", port_num);
-    if ((lfd = open_listenfd(port_str)) < 0) {
-      perror("open_listenfd");
-      continue;
-    }
-    if ((pid = fork()) == 0) {
-      close(ATC_INFO.listenfd);
-      initialise_node(idx, ATC_INFO.gate_counts[idx], lfd);
-      exit(0);
-    } else if (pid < 0) {
-      perror("fork");
-    } else {
-      node->pid = pid;
-      fprintf(stderr, "[Controller] Airport %d assigned port %s\n", idx, port_str);
-      close(lfd);
+  int ready_pipe[2], expected = 0;
+  if (ATC_INFO.ready_file) {
+    if (pipe(ready_pipe) < 0) {
+      perror("[Controller] pipe");
+      exit(1);
     }
+    AIRPORT_CONFIG.ready_fd = ready_pipe[1];
   }
 
+  if (ATC_INFO.num_hosts > 0) {
+    for (idx = 0; idx < ATC_INFO.num_hosts; idx++)
+      expected += spawn_host(idx) == 0;
+  } else if (!ATC_INFO.lazy) {
+    expected = start_airports();
+  }
+
+  if (ATC_INFO.ready_file)
+    wait_until_ready(ready_pipe, expected);
+  // after the startup forks, so no airport holds the file open
+  if (ATC_INFO.trace_file && trace_open(ATC_INFO.trace_file) < 0) {
+    perror("[Controller] trace file");
+    exit(1);
+  }
+
+  reset_relay_pipe();
   signal(SIGCHLD, sigchld_handler);
-  controller_server_loop();
+  signal(SIGPIPE, SIG_IGN);
+
+  pthread_t prober, optimizer, front_end;
+  if (pthread_create(&prober, NULL, probe_thread, NULL) == 0)
+    pthread_detach(prober);
+  if (ATC_INFO.optimize_ms > 0 && pthread_create(&optimizer, NULL, optimize_thread, NULL) == 0)
+    pthread_detach(optimizer);
+  // this thread is front-end 0
+  for (idx = 1; idx < ATC_INFO.num_front_ends; idx++) {
+    if (pthread_create(&front_end, NULL, front_end_thread,
+                       (void *)(intptr_t)front_end_fds[idx]) != 0) {
+      perror("[Controller] pthread_create");
+      exit(1);
+    }
+    pthread_detach(front_end);
+  }
+  controller_server_loop(ATC_INFO.listenfd);
   exit(0);
 }
 
 /** @brief Prints usage information for the program and then exits. */
 void print_usage(char *program_name) {
-  printf("Usage: %s [-n N] [-p P] -- [gate count list]\n", program_name);
+  printf("Usage: %s [-n N] [-m M] [-H H] [-L] [-R F] [-T F] [-a CPUS] [-f F] [-y Y] [-c C] [-p P] [-s] [-w W] [-j MIN[-MAX]] [-b] [-d D] [-u U] [-t T] [-r R] [-O O]"
+         " -- [gate count list]\n",
+         program_name);
   printf("  -n: Number of airports to create.\n");
+  printf("  -m: Most airports there can be, counting ADD_AIRPORT (default: N + %d).\n",
+         DEFAULT_SPARE_AIRPORTS);
+  printf("  -H: Serve the -n airports from H processes instead of one each.\n");
+  printf("  -L: Only start an airport's node when it gets its first request.\n");
+  printf("  -R: File to create once every airport is ready for requests.\n");
+  printf("  -T: Record every client request to this file (JSON Lines, see replay).\n");
+  printf("  -a: Pin airport nodes (or hosts) to shares of these CPUs, NUMA node by node.\n");
+  printf("  -f: Number of front-end threads accepting clients on the port (1-%d).\n",
+         MAX_FRONT_ENDS);
+  printf("  -y: Read-only replicas to run for each airport (0-%d).\n", MAX_REPLICAS);
+  printf("  -c: Cache up to C PLANE_STATUS/TIME_STATUS replies in the controller.\n");
   printf("  -p: Port number to use for controller.\n");
+  printf("  -s: Talk to airports over shared memory instead of TCP.\n");
+  printf("  -w: Airport queue length at which new requests get BUSY (1-%d).\n", MAX_QUEUE);
+  printf("  -j: Worker threads per airport node, MIN kept always, growing to MAX\n"
+         "      under load (default: 1-<online CPUs, at least 4>, MAX up to %d).\n",
+         MAX_WORKERS);
+  printf("  -b: Place concurrent SCHEDULEs for an airport in combined batches.\n");
+  printf("  -d: Default ms a request may wait in an airport queue (0 = forever).\n");
+  printf("  -u: Fuel at or below which SCHEDULE requests are served first.\n");
+  printf("  -t: Timeout in ms for connecting to and reading from airports.\n");
+  printf("  -r: Number of retries for PLANE_STATUS and TIME_STATUS requests.\n");
+  printf("  -O: Send every airport OPTIMIZE each O ms (default: 0, never).\n");
   printf("  -h: Print this help message and exit.\n");
   exit(0);
 }
@@ -289,17 +1441,85 @@ int parse_args(int argc, char *argv[]) {
   int c, ret = 0, *gate_counts = NULL;
   int atc_portnum = DEFAULT_PORTNUM;
   int num_airports = 0;
+  int max_airports = 0;
+  int num_hosts = 0;
+  int lazy = 0;
+  char *ready_file = NULL, *trace_file = NULL;
+  char *cpu_list = NULL;
+  int num_front_ends = 1;
+  int replicas = 0;
+  int cache_entries = 0;
   int max_portnum = MAX_PORTNUM;
+  int use_shm = 0;
+  int timeout_ms = DEFAULT_TIMEOUT_MS;
+  int retries = DEFAULT_RETRIES;
+  int optimize_ms = 0;
 
-  while ((c = getopt(argc, argv, "n:p:h")) != -1) {
+  while ((c = getopt(argc, argv, "n:m:H:LR:T:a:f:y:c:p:sw:j:bd:u:t:r:O:h")) != -1) {
     switch (c) {
     case 'n':
       sscanf(optarg, "%d", &num_airports);
-      max_portnum -= num_airports;
+      break;
+    case 'm':
+      sscanf(optarg, "%d", &max_airports);
+      break;
+    case 'H':
+      sscanf(optarg, "%d", &num_hosts);
+      break;
+    case 'L':
+      lazy = 1;
+      break;
+    case 'R':
+      ready_file = optarg;
+      break;
+    case 'T':
+      trace_file = optarg;
+      break;
+    case 'a':
+      cpu_list = optarg;
+      break;
+    case 'f':
+      sscanf(optarg, "%d", &num_front_ends);
+      break;
+    case 'y':
+      sscanf(optarg, "%d", &replicas);
+      break;
+    case 'c':
+      sscanf(optarg, "%d", &cache_entries);
       break;
     case 'p':
       sscanf(optarg, "%d", &atc_portnum);
       break;
+    case 's':
+      use_shm = 1;
+      break;
+    case 'w':
+      sscanf(optarg, "%d", &AIRPORT_CONFIG.queue_watermark);
+      break;
+    case 'j':
+      // a single number fixes the pool at that size
+      if (sscanf(optarg, "%d-%d", &AIRPORT_CONFIG.min_workers,
+                 &AIRPORT_CONFIG.max_workers) == 1)
+        AIRPORT_CONFIG.max_workers = AIRPORT_CONFIG.min_workers;
+      break;
+    case 'b':
+      AIRPORT_CONFIG.combine = 1;
+      break;
+    case 'd':
+      sscanf(optarg, "%d", &AIRPORT_CONFIG.default_deadline_ms);
+      break;
+    case 'u':
+      sscanf(optarg, "%d", &AIRPORT_CONFIG.urgent_fuel);
+      break;
+    case 't':
+      sscanf(optarg, "%d", &timeout_ms);
+      break;
+    case 'r':
+      sscanf(optarg, "%d", &retries);
+      break;
+    case 'O':
+      sscanf(optarg, "%d", &optimize_ms);
+      break;
     case 'h':
       print_usage(argv[0]);
       break;
@@ -311,10 +1531,81 @@ int parse_args(int argc, char *argv[]) {
     }
   }
 
+  if (max_airports == 0)
+    max_airports = num_airports + DEFAULT_SPARE_AIRPORTS;
+  // airports on shared memory don't need a port each, replicas always do
+  if (!use_shm)
+    max_portnum -= max_airports;
+  if (replicas > 0 && replicas <= MAX_REPLICAS)
+    max_portnum -= max_airports * replicas;
+
   if (num_airports <= 0) {
     fprintf(stderr, "-n must be greater than 0.\n");
     ret = -1;
   }
+  if (max_airports < num_airports) {
+    fprintf(stderr, "-m must be at least -n.\n");
+    ret = -1;
+  }
+  if (num_hosts < 0 || num_hosts > num_airports) {
+    fprintf(stderr, "-H must be between 0-%d.\n", num_airports);
+    ret = -1;
+  }
+  // one ring pair per airport, a host would need to share it between several
+  if (num_hosts > 0 && use_shm) {
+    fprintf(stderr, "-H can't be used with -s.\n");
+    ret = -1;
+  }
+  if (num_hosts > 0 && lazy) {
+    fprintf(stderr, "-H can't be used with -L.\n");
+    ret = -1;
+  }
+  if (num_front_ends < 1 || num_front_ends > MAX_FRONT_ENDS) {
+    fprintf(stderr, "-f must be between 1-%d.\n", MAX_FRONT_ENDS);
+    ret = -1;
+  }
+  if (replicas < 0 || replicas > MAX_REPLICAS) {
+    fprintf(stderr, "-y must be between 0-%d.\n", MAX_REPLICAS);
+    ret = -1;
+  }
+  // replicas follow their primary over TCP, and a host's airports share a port
+  if (replicas > 0 && (use_shm || num_hosts > 0)) {
+    fprintf(stderr, "-y can't be used with -s or -H.\n");
+    ret = -1;
+  }
+  if (cache_entries < 0 || (cache_entries > 0 && read_cache_init(cache_entries) < 0)) {
+    fprintf(stderr, "-c must be a number of replies to cache (0 for none).\n");
+    ret = -1;
+  }
+  if (cpu_list && affinity_init(cpu_list) < 0) {
+    fprintf(stderr, "-a must be a list of usable CPUs (like 0-3,8) or 'all'.\n");
+    ret = -1;
+  }
+  if (AIRPORT_CONFIG.queue_watermark < 1 || AIRPORT_CONFIG.queue_watermark > MAX_QUEUE) {
+    fprintf(stderr, "-w must be between 1-%d.\n", MAX_QUEUE);
+    ret = -1;
+  }
+  if (AIRPORT_CONFIG.min_workers < 1 || AIRPORT_CONFIG.max_workers > MAX_WORKERS ||
+      (AIRPORT_CONFIG.max_workers && AIRPORT_CONFIG.max_workers < AIRPORT_CONFIG.min_workers)) {
+    fprintf(stderr, "-j must be MIN or MIN-MAX with 1 <= MIN <= MAX <= %d.\n", MAX_WORKERS);
+    ret = -1;
+  }
+  if (AIRPORT_CONFIG.default_deadline_ms < 0) {
+    fprintf(stderr, "-d must not be negative.\n");
+    ret = -1;
+  }
+  if (timeout_ms <= 0) {
+    fprintf(stderr, "-t must be greater than 0.\n");
+    ret = -1;
+  }
+  if (retries < 0) {
+    fprintf(stderr, "-r must not be negative.\n");
+    ret = -1;
+  }
+  if (optimize_ms < 0) {
+    fprintf(stderr, "-O must not be negative.\n");
+    ret = -1;
+  }
   if (atc_portnum < MIN_PORTNUM || atc_portnum >= max_portnum) {
     fprintf(stderr, "-p must be between %d-%d.\n", MIN_PORTNUM, max_portnum);
     ret = -1;
@@ -324,9 +1615,30 @@ int parse_args(int argc, char *argv[]) {
     if ((gate_counts = parse_gate_counts(argv[optind], num_airports)) == NULL)
       return -1;
     ATC_INFO.num_airports = num_airports;
+    ATC_INFO.max_airports = max_airports;
+    ATC_INFO.num_hosts = num_hosts;
+    ATC_INFO.lazy = lazy;
+    ATC_INFO.ready_file = ready_file;
+    ATC_INFO.trace_file = trace_file;
     ATC_INFO.gate_counts = gate_counts;
     ATC_INFO.portnum = atc_portnum;
-    ATC_INFO.airport_nodes = calloc((unsigned)num_airports, sizeof(node_info_t));
+    ATC_INFO.use_shm = use_shm;
+    ATC_INFO.timeout_ms = timeout_ms;
+    ATC_INFO.retries = retries;
+    ATC_INFO.optimize_ms = optimize_ms;
+    ATC_INFO.num_front_ends = num_front_ends;
+    ATC_INFO.replicas_per_airport = replicas;
+    AIRPORT_CONFIG.read_cache = cache_entries > 0;
+    if (cpu_list)
+      ATC_INFO.pin_slots = num_hosts > 0 ? num_hosts : num_airports;
+    // sized for every airport up front, so the table never moves under the
+    // probe thread
+    ATC_INFO.airport_nodes = calloc((unsigned)max_airports, sizeof(node_info_t));
+    if (replicas > 0) {
+      node_info_t *pool = calloc((size_t)max_airports * (size_t)replicas, sizeof(node_info_t));
+      for (int idx = 0; idx < max_airports; idx++)
+        ATC_INFO.airport_nodes[idx].replicas = &pool[idx * replicas];
+    }
   }
 
   return ret;
@@ -0,0 +1,22 @@
+#include "format.h"
+#include "airport.h"
+
+/* Slot times are made by the preprocessor, for as many slots as an occupancy
+ * word has bits, so changing NUM_TIME_SLOTS doesn't need a new table. */
+#define FMT_MAX_SLOTS 64
+_Static_assert(NUM_TIME_SLOTS <= FMT_MAX_SLOTS, "FMT_SLOT_TIMES is too short");
+
+// slot i starts at hour i / 2, on the half hour when i is odd
+#define SLOT_TIME(i) \
+  {(char)('0' + (i) / 20), (char)('0' + (i) / 2 % 10), ':', (i) % 2 ? '3' : '0', '0'}
+#define SLOT_TIMES_4(i) SLOT_TIME(i), SLOT_TIME((i) + 1), SLOT_TIME((i) + 2), SLOT_TIME((i) + 3)
+#define SLOT_TIMES_16(i) \
+  SLOT_TIMES_4(i), SLOT_TIMES_4((i) + 4), SLOT_TIMES_4((i) + 8), SLOT_TIMES_4((i) + 12)
+
+const char FMT_SLOT_TIMES[FMT_MAX_SLOTS][FMT_TIME_LEN] = {
+    SLOT_TIMES_16(0), SLOT_TIMES_16(16), SLOT_TIMES_16(32), SLOT_TIMES_16(48)};
+
+#define DIGIT_PAIRS(t) #t "0" #t "1" #t "2" #t "3" #t "4" #t "5" #t "6" #t "7" #t "8" #t "9"
+
+const char FMT_DIGIT_PAIRS[200] = DIGIT_PAIRS(0) DIGIT_PAIRS(1) DIGIT_PAIRS(2) DIGIT_PAIRS(3)
+    DIGIT_PAIRS(4) DIGIT_PAIRS(5) DIGIT_PAIRS(6) DIGIT_PAIRS(7) DIGIT_PAIRS(8) DIGIT_PAIRS(9);
@@ -0,0 +1,75 @@
+#ifndef FORMAT_HEADER
+#define FORMAT_HEADER
+
+#include <stddef.h>
+#include <string.h>
+
+/** Reply formatting without printf.
+ *
+ *  The airport's replies are a handful of fixed line shapes filled in with
+ *  small numbers and slot times, sent over and over (a whole-day TIME_STATUS
+ *  is 48 of them). These helpers build them by copying: the fixed text with
+ *  `memcpy`, slot times from a table of every `HH:MM` made at compile time,
+ *  and numbers two digits at a time from a table of `00`..`99`. Each one
+ *  writes at `p` and returns the end of what it wrote, so a line is a chain of
+ *  calls into a buffer that's known to be big enough; nothing is terminated.
+ *  The output is exactly what the `%d` and `%02d:%02d` formats it replaces
+ *  would give.
+ */
+
+#define FMT_INT_MAX 20  /* Longest number fmt_int/fmt_uint can write */
+#define FMT_TIME_LEN 5  /* `HH:MM` */
+
+/* `HH:MM` for every time slot, see airport.h. */
+extern const char FMT_SLOT_TIMES[][FMT_TIME_LEN];
+
+/* `00`, `01`, ... `99`, back to back. */
+extern const char FMT_DIGIT_PAIRS[200];
+
+/* Copies the string literal `lit`, without its terminator. */
+#define FMT_LIT(p, lit) fmt_text((p), (lit), sizeof(lit) - 1)
+
+static inline char *fmt_text(char *p, const char *text, size_t n) {
+  memcpy(p, text, n);
+  return p + n;
+}
+
+static inline char *fmt_uint(char *p, unsigned long v) {
+  char digits[FMT_INT_MAX];
+  char *d = digits + sizeof(digits);
+  while (v >= 100) {
+    d -= 2;
+    memcpy(d, &FMT_DIGIT_PAIRS[(v % 100) * 2], 2);
+    v /= 100;
+  }
+  if (v >= 10) {
+    d -= 2;
+    memcpy(d, &FMT_DIGIT_PAIRS[v * 2], 2);
+  } else {
+    *--d = (char)('0' + v);
+  }
+  return fmt_text(p, d, (size_t)(digits + sizeof(digits) - d));
+}
+
+static inline char *fmt_int(char *p, long v) {
+  if (v < 0) {
+    *p++ = '-';
+    // negated as unsigned, so LONG_MIN works too
+    return fmt_uint(p, 0UL - (unsigned long)v);
+  }
+  return fmt_uint(p, (unsigned long)v);
+}
+
+/* `HH:MM` for slot `idx`, which has to be a valid slot. */
+static inline char *fmt_slot_time(char *p, int idx) {
+  return fmt_text(p, FMT_SLOT_TIMES[idx], FMT_TIME_LEN);
+}
+
+/* `HH:MM-HH:MM` for slots `start`..`end`. */
+static inline char *fmt_slot_range(char *p, int start, int end) {
+  p = fmt_slot_time(p, start);
+  *p++ = '-';
+  return fmt_slot_time(p, end);
+}
+
+#endif
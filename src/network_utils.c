@@ -1,4 +1,5 @@
 #include "network_utils.h"
+#include <poll.h>
 #include <stdarg.h>
 
 void gai_error(int code, char *msg) { /* getaddrinfo-style error */
@@ -45,12 +46,68 @@ int open_clientfd(char *hostname, char *port) {
     return clientfd;
 }
 
+/* Wait up to timeout_ms for fd to become ready for `events`.
+ *
+ * Returns 1 if ready, 0 on timeout and -1 on error.
+ */
+int rio_wait(int fd, short events, int timeout_ms) {
+  struct pollfd pfd = {.fd = fd, .events = events};
+  int rc;
+  while ((rc = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR)
+    ;
+  return rc;
+}
+
+/*
+ * open_clientfd_timeout - Same as open_clientfd, but gives up on an address
+ *     if connecting to it takes longer than timeout_ms. The returned socket
+ *     is in blocking mode.
+ *
+ *     On error, returns -1.
+ */
+int open_clientfd_timeout(char *hostname, char *port, int timeout_ms) {
+  int clientfd = -1, rc, flags, err;
+  socklen_t errlen = sizeof(err);
+  struct addrinfo hints, *listp, *p;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+  if ((rc = getaddrinfo(hostname, port, &hints, &listp)) != 0)
+    gai_error(rc, "getaddrinfo error");
+
+  for (p = listp; p; p = p->ai_next) {
+    if ((clientfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0)
+      continue;
+
+    /* Connect without blocking, then wait for the handshake to finish */
+    flags = fcntl(clientfd, F_GETFL);
+    fcntl(clientfd, F_SETFL, flags | O_NONBLOCK);
+    rc = connect(clientfd, p->ai_addr, p->ai_addrlen);
+    if (rc < 0 && errno == EINPROGRESS && rio_wait(clientfd, POLLOUT, timeout_ms) > 0 &&
+        getsockopt(clientfd, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0 && err == 0)
+      rc = 0;
+    if (rc == 0) {
+      fcntl(clientfd, F_SETFL, flags);
+      break;
+    }
+    close(clientfd);
+  }
+
+  freeaddrinfo(listp);
+  if (!p) /* All connects failed or timed out */
+    return -1;
+  return clientfd;
+}
+
 /* Open and return a listening socket on the given port. This function is
- * reentrant and protocol-independent.
+ * reentrant and protocol-independent. With `reuseport`, other sockets opened
+ * the same way can listen on the port too, and the kernel spreads incoming
+ * connections between them.
  *
  * On error, returns -1 and sets errno.
  */
-int open_listenfd(char *port) {
+static int open_listenfd_opts(char *port, int reuseport) {
   struct addrinfo hints, *listp, *p;
   int listenfd, rc, optval = 1;
 
@@ -71,6 +128,11 @@ int open_listenfd(char *port) {
     /* Eliminates "Address already in use" error from bind */
     setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval,
                sizeof(int));
+    if (reuseport &&
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, (const void *)&optval, sizeof(int)) < 0) {
+      close(listenfd);
+      continue;
+    }
 
     /* Bind the descriptor to the address */
     if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
@@ -91,6 +153,58 @@ int open_listenfd(char *port) {
   return listenfd;
 }
 
+int open_listenfd(char *port) {
+  return open_listenfd_opts(port, 0);
+}
+
+int open_reuseport_listenfd(char *port) {
+  return open_listenfd_opts(port, 1);
+}
+
+/* Opens listening sockets on `count` consecutive ports starting at
+ * `first_port`, storing them in `fds` (-1 for any port that couldn't be
+ * bound). The address is only looked up once, which is most of the cost of
+ * open_listenfd when there are thousands of ports to open.
+ *
+ * Returns the number of sockets opened.
+ */
+int open_listenfds(int first_port, int count, int *fds) {
+  struct addrinfo hints, *listp, *p;
+  struct sockaddr_storage addr;
+  char port[16];
+  int opened = 0, rc, optval = 1;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV;
+  snprintf(port, sizeof(port), "%d", first_port);
+  if ((rc = getaddrinfo(NULL, port, &hints, &listp)) != 0)
+    gai_error(rc, "getaddrinfo error");
+
+  for (int i = 0; i < count; i++) {
+    fds[i] = -1;
+    for (p = listp; p; p = p->ai_next) {
+      int fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+      if (fd < 0)
+        continue;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const void *)&optval, sizeof(int));
+      memcpy(&addr, p->ai_addr, p->ai_addrlen);
+      if (p->ai_family == AF_INET6)
+        ((struct sockaddr_in6 *)&addr)->sin6_port = htons((uint16_t)(first_port + i));
+      else
+        ((struct sockaddr_in *)&addr)->sin_port = htons((uint16_t)(first_port + i));
+      if (bind(fd, (SA *)&addr, p->ai_addrlen) == 0 && listen(fd, LISTENQ) == 0) {
+        fds[i] = fd;
+        opened++;
+        break;
+      }
+      close(fd);
+    }
+  }
+  freeaddrinfo(listp);
+  return opened;
+}
+
 /*
  * rio_readn - Robustly read n bytes (unbuffered)
  */
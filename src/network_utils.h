@@ -24,7 +24,11 @@ extern char **environ; /* Defined by libc */
 typedef struct sockaddr SA;
 
 int open_clientfd(char *hostname, char *port);
+int open_clientfd_timeout(char *hostname, char *port, int timeout_ms);
+int rio_wait(int fd, short events, int timeout_ms);
 int open_listenfd(char *port);
+int open_reuseport_listenfd(char *port);
+int open_listenfds(int first_port, int count, int *fds);
 void gai_error(int code, char *msg);
 
 #define RIO_BUFSIZE 8192
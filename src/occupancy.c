@@ -0,0 +1,42 @@
+#include "occupancy.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_PATH 1
+#endif
+
+static int find_free_scalar(const uint64_t *occ, int from, int num_gates, uint64_t mask,
+                            int *free_gates) {
+  int found = 0;
+  for (int g = from; g < num_gates; g++)
+    if ((__atomic_load_n(&occ[g], __ATOMIC_RELAXED) & mask) == 0)
+      free_gates[found++] = g;
+  return found;
+}
+
+#ifdef HAVE_AVX2_PATH
+__attribute__((target("avx2"))) static int find_free_avx2(const uint64_t *occ, int num_gates,
+                                                          uint64_t mask, int *free_gates) {
+  const __m256i want = _mm256_set1_epi64x((long long)mask);
+  const __m256i zero = _mm256_setzero_si256();
+  int found = 0, g;
+  for (g = 0; g + OCC_LANES <= num_gates; g += OCC_LANES) {
+    __m256i words = _mm256_load_si256((const __m256i *)(occ + g));
+    __m256i clear = _mm256_cmpeq_epi64(_mm256_and_si256(words, want), zero);
+    unsigned bits = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(clear));
+    while (bits) {
+      free_gates[found++] = g + __builtin_ctz(bits);
+      bits &= bits - 1;
+    }
+  }
+  return found + find_free_scalar(occ, g, num_gates, mask, free_gates + found);
+}
+#endif
+
+int occupancy_find_free(const uint64_t *occ, int num_gates, uint64_t mask, int *free_gates) {
+#ifdef HAVE_AVX2_PATH
+  if (__builtin_cpu_supports("avx2"))
+    return find_free_avx2(occ, num_gates, mask, free_gates);
+#endif
+  return find_free_scalar(occ, 0, num_gates, mask, free_gates);
+}
@@ -0,0 +1,33 @@
+#ifndef OCCUPANCY_HEADER
+#define OCCUPANCY_HEADER
+
+#include <stdint.h>
+
+/** Occupancy bitmaps: one 64-bit word per gate, where bit `s` is set while
+ *  time slot `s` of that gate is taken. The words for each segment of an
+ *  airport's gates sit next to each other (see `gate_segment_t`), so an
+ *  availability query is a linear scan that tests several gates per vector
+ *  instruction.
+ */
+
+/* Gates tested per AVX2 instruction; bitmap arrays must be aligned to this
+ * many words. */
+#define OCC_LANES 4
+#define OCC_ALIGN (OCC_LANES * sizeof(uint64_t))
+
+/* Bits for the slots `start`..`end` (inclusive). */
+#define OCC_MASK(start, end) \
+  ((((uint64_t)1 << ((end) - (start) + 1)) - 1) << (start))
+
+/** @brief Finds every gate whose bitmap has none of the bits in `mask` set.
+ *
+ *  Uses AVX2 when the CPU supports it and a scalar loop otherwise.
+ *
+ *  @param free_gates Filled with the indices of the free gates, in increasing
+ *                    order. Must have room for `num_gates` entries.
+ *
+ *  @returns The number of free gates found.
+ */
+int occupancy_find_free(const uint64_t *occ, int num_gates, uint64_t mask, int *free_gates);
+
+#endif
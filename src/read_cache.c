@@ -0,0 +1,100 @@
+#include "read_cache.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  char *key; /* NULL while the slot is empty */
+  unsigned long version;
+  unsigned long gen;
+  char *reply;
+  size_t len;
+} cache_entry_t;
+
+static cache_entry_t *ENTRIES = NULL;
+static size_t NUM_ENTRIES = 0;
+static pthread_mutex_t LOCKS[READ_CACHE_LOCKS];
+
+/* FNV-1a, the keys are short request lines */
+static size_t hash_key(const char *key) {
+  size_t h = 1469598103934665603ULL;
+  for (; *key; key++)
+    h = (h ^ (unsigned char)*key) * 1099511628211ULL;
+  return h;
+}
+
+int read_cache_init(int entries) {
+  if (entries <= 0 || (ENTRIES = calloc((size_t)entries, sizeof(cache_entry_t))) == NULL)
+    return -1;
+  NUM_ENTRIES = (size_t)entries;
+  for (int i = 0; i < READ_CACHE_LOCKS; i++)
+    pthread_mutex_init(&LOCKS[i], NULL);
+  return 0;
+}
+
+int read_cache_enabled(void) {
+  return ENTRIES != NULL;
+}
+
+/* Locks and returns the slot `key` belongs in. */
+static cache_entry_t *lock_slot(const char *key) {
+  size_t slot = hash_key(key) % NUM_ENTRIES;
+  pthread_mutex_lock(&LOCKS[slot % READ_CACHE_LOCKS]);
+  return &ENTRIES[slot];
+}
+
+static void unlock_slot(cache_entry_t *entry) {
+  pthread_mutex_unlock(&LOCKS[(size_t)(entry - ENTRIES) % READ_CACHE_LOCKS]);
+}
+
+int read_cache_get(const char *key, unsigned long *version, unsigned long *gen, char **reply,
+                   size_t *len) {
+  cache_entry_t *entry = lock_slot(key);
+  int found = entry->key && strcmp(entry->key, key) == 0;
+  if (found) {
+    *version = entry->version;
+    *gen = entry->gen;
+    if (reply) {
+      // copied, so a slow client isn't written to with the slot locked
+      if ((*reply = malloc(entry->len)) == NULL)
+        found = 0;
+      else {
+        memcpy(*reply, entry->reply, entry->len);
+        *len = entry->len;
+      }
+    }
+  }
+  unlock_slot(entry);
+  return found;
+}
+
+void read_cache_put(const char *key, unsigned long version, unsigned long gen,
+                    const char *reply, size_t len) {
+  if (len > READ_CACHE_MAX_REPLY)
+    return;
+  char *key_copy = strdup(key), *reply_copy = malloc(len ? len : 1);
+  if (!key_copy || !reply_copy) {
+    free(key_copy);
+    free(reply_copy);
+    return;
+  }
+  memcpy(reply_copy, reply, len);
+
+  cache_entry_t *entry = lock_slot(key);
+  char *old_key = entry->key, *old_reply = entry->reply;
+  entry->key = key_copy;
+  entry->version = version;
+  entry->gen = gen;
+  entry->reply = reply_copy;
+  entry->len = len;
+  unlock_slot(entry);
+  free(old_key);
+  free(old_reply);
+}
+
+void read_cache_revalidate(const char *key, unsigned long version, unsigned long gen) {
+  cache_entry_t *entry = lock_slot(key);
+  if (entry->key && strcmp(entry->key, key) == 0 && entry->version == version)
+    entry->gen = gen;
+  unlock_slot(entry);
+}
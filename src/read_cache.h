@@ -0,0 +1,50 @@
+#ifndef READ_CACHE_HEADER
+#define READ_CACHE_HEADER
+
+#include <stddef.h>
+
+/** The controller's cache of read replies (`-c`).
+ *
+ *  Replies are kept by request line in a fixed number of slots (a new entry
+ *  simply replaces whatever hashed to the same slot), each with the airport's
+ *  version of what it read and the controller's write generation for the
+ *  airport when it was filled. The controller decides what those mean, see
+ *  `forward_cached_read`.
+ */
+
+#define READ_CACHE_LOCKS 64       /* Slots share this many locks */
+#define READ_CACHE_MAX_REPLY 8192 /* Longer replies aren't cached */
+
+/** @brief Sets up a cache with room for `entries` replies.
+ *
+ *  @returns 0 on success, -1 if it couldn't be allocated.
+ */
+int read_cache_init(int entries);
+
+/** @brief Returns 1 if the cache has been set up. */
+int read_cache_enabled(void);
+
+/** @brief Looks up the reply to `key`.
+ *
+ *  @param version Set to the airport's version of the cached reply.
+ *  @param gen     Set to the write generation it was last known good at.
+ *  @param reply   If not NULL, set to a copy of the reply (free it), with its
+ *                 length in `len`.
+ *
+ *  @returns 1 if `key` is cached, 0 if it isn't.
+ */
+int read_cache_get(const char *key, unsigned long *version, unsigned long *gen, char **reply,
+                   size_t *len);
+
+/** @brief Caches `reply` as the answer to `key`, replacing whatever was in
+ *         its slot.
+ */
+void read_cache_put(const char *key, unsigned long version, unsigned long gen,
+                    const char *reply, size_t len);
+
+/** @brief Marks the cached reply to `key` as still good at write generation
+ *         `gen`, if it's still the one with `version`.
+ */
+void read_cache_revalidate(const char *key, unsigned long version, unsigned long gen);
+
+#endif
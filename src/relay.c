@@ -0,0 +1,70 @@
+/* Kept apart from network_utils.c because splice() needs _GNU_SOURCE, which
+ * clashes with the gai_error() helper declared in network_utils.h. */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "relay.h"
+
+/*
+ * rio_copy - Copy everything from infd to outfd through a user buffer. Used
+ *     when splice() isn't supported by one of the descriptors.
+ */
+static ssize_t rio_copy(int infd, int outfd) {
+  char buf[RELAY_BUFSIZE], *bufp;
+  ssize_t n, nwritten, total = 0;
+  while (1) {
+    if ((n = read(infd, buf, sizeof(buf))) < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      return total; /* EOF */
+    for (bufp = buf; n > 0; n -= nwritten, bufp += nwritten, total += nwritten) {
+      if ((nwritten = write(outfd, bufp, (size_t)n)) < 0) {
+        if (errno != EINTR)
+          return -1;
+        nwritten = 0;
+      }
+    }
+  }
+}
+
+/*
+ * rio_splice - Move everything readable from infd (until EOF) to outfd
+ *     through the kernel pipe pipefd, without copying it through user
+ *     space. Falls back to rio_copy if the descriptors can't be spliced.
+ *
+ *     Returns the number of bytes moved, or -1 on error (errno set). After an
+ *     error the pipe may still hold data and should be replaced.
+ */
+ssize_t rio_splice(int infd, int outfd, int pipefd[2]) {
+  ssize_t in, out, total = 0;
+  // no SPLICE_F_MORE, on the socket it corks the end of a reply for 200ms
+  // when the client keeps its connection open for the next request
+  unsigned flags = SPLICE_F_MOVE;
+
+  while (1) {
+    if ((in = splice(infd, NULL, pipefd[1], NULL, RIO_SPLICE_CHUNK, flags)) < 0) {
+      if (errno == EINTR)
+        continue;
+      if (total == 0 && (errno == EINVAL || errno == ENOSYS))
+        return rio_copy(infd, outfd);
+      return -1;
+    }
+    if (in == 0)
+      break; /* EOF */
+    while (in > 0) {
+      if ((out = splice(pipefd[0], NULL, outfd, NULL, (size_t)in, flags)) < 0) {
+        if (errno == EINTR)
+          continue;
+        return -1;
+      }
+      in -= out;
+      total += out;
+    }
+  }
+  return total;
+}
@@ -0,0 +1,19 @@
+#ifndef RELAY_HEADER
+#define RELAY_HEADER
+
+#include <sys/types.h>
+
+#define RELAY_BUFSIZE 8192      /* Buffer used when splice() is unavailable */
+#define RIO_SPLICE_CHUNK 65536  /* Max bytes moved per splice() call */
+
+/** @brief Moves everything readable from `infd` (until EOF) to `outfd`
+ *         through the kernel pipe `pipefd`, without copying it through user
+ *         space. Falls back to a read/write copy if the descriptors can't be
+ *         spliced.
+ *
+ *  @returns The number of bytes moved, or -1 on error (errno set). After an
+ *           error the pipe may still hold data and should be replaced.
+ */
+ssize_t rio_splice(int infd, int outfd, int pipefd[2]);
+
+#endif
@@ -0,0 +1,409 @@
+/** Replays a trace recorded with `controller -T` against a running network.
+ *
+ *  Each connection in the trace gets a connection of its own, and its
+ *  requests are sent at the offsets they were recorded at (divided by `-s`),
+ *  or as fast as possible with `-s max`. Requests are written regardless of
+ *  replies, just like the clients that were recorded did, and a connection's
+ *  write side is shut once its last request has gone. Everything it gets back
+ *  until EOF is its reply.
+ *
+ *  At the end it prints the throughput and the latency from each
+ *  connection's last request to the end of its reply (for the usual one
+ *  request per connection, that's the request's latency). `-o` saves the
+ *  replies, and `-e` compares them with replies saved by an earlier replay,
+ *  e.g. against the previous release.
+ */
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+
+#include "network_utils.h"
+#include "trace.h"
+
+#define DEFAULT_PORT "1024"
+#define MAX_OPEN 512          /* connections open at once */
+#define REPLY_TIMEOUT_MS 5000 /* a reply that stalls this long is cut off (WATCH never ends) */
+#define MAX_REPORTED_DIFFS 10
+
+typedef struct {
+  long t_us;          /* offset from the start of the trace */
+  unsigned long conn; /* connection number */
+  char *req;          /* request line, without the newline */
+} record_t;
+
+typedef struct {
+  int used;         /* 1 if the trace has any requests on it */
+  int fd;           /* -1 unless open */
+  size_t first;     /* index of its first record */
+  size_t last;      /* index of its last record */
+  long sent_us;     /* when its last request went, 0 until then */
+  long active_us;   /* when it last sent or received anything */
+  long done_us;     /* when its reply ended, 0 until then */
+  int failed;       /* couldn't connect, write, or the reply timed out */
+  char *reply;
+  size_t len, cap;
+} replay_conn_t;
+
+static long now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Reads a JSON string starting just after its opening quote. Returns a new
+ * string (its length in `*len`, if not NULL), or NULL if it isn't
+ * terminated. */
+static char *json_unescape(const char *p, size_t *len) {
+  char *out = malloc(strlen(p) + 1), *o = out;
+  if (!out)
+    return NULL;
+  for (; *p && *p != '"'; p++) {
+    if (*p != '\\') {
+      *o++ = *p;
+      continue;
+    }
+    switch (*++p) {
+    case 'n': *o++ = '\n'; break;
+    case 'r': *o++ = '\r'; break;
+    case 't': *o++ = '\t'; break;
+    case 'u': {
+      unsigned code;
+      if (sscanf(p + 1, "%4x", &code) != 1) {
+        free(out);
+        return NULL;
+      }
+      *o++ = (char)code; // we only ever write \u00XX
+      p += 4;
+      break;
+    }
+    case '\0':
+      free(out);
+      return NULL;
+    default: *o++ = *p; break; // \" \\ \/
+    }
+  }
+  if (*p != '"') {
+    free(out);
+    return NULL;
+  }
+  *o = '\0';
+  if (len)
+    *len = (size_t)(o - out);
+  return out;
+}
+
+static int compare_records(const void *a, const void *b) {
+  const record_t *x = a, *y = b;
+  return (x->t_us > y->t_us) - (x->t_us < y->t_us);
+}
+
+/* Loads every request in a trace, in time order. */
+static int load_trace(const char *path, record_t **records, size_t *count) {
+  FILE *f = fopen(path, "r");
+  char *line = NULL;
+  size_t line_cap = 0, n = 0, cap = 0;
+  record_t *recs = NULL;
+  unsigned long dropped, lineno = 0;
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  while (getline(&line, &line_cap, f) > 0) {
+    record_t rec;
+    int off = 0;
+    lineno++;
+    if (sscanf(line, "{\"dropped\":%lu}", &dropped) == 1) {
+      fprintf(stderr, "Warning: %lu requests weren't recorded before line %lu\n",
+              dropped, lineno);
+      continue;
+    }
+    if (sscanf(line, "{\"t_us\":%ld,\"conn\":%lu,\"req\":\"%n", &rec.t_us, &rec.conn, &off) < 2 ||
+        off == 0 || (rec.req = json_unescape(line + off, NULL)) == NULL) {
+      fprintf(stderr, "%s:%lu: not a trace record\n", path, lineno);
+      continue;
+    }
+    if (n == cap) {
+      cap = cap ? cap * 2 : 1024;
+      recs = realloc(recs, sizeof(record_t) * cap);
+      if (!recs) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    recs[n++] = rec;
+  }
+  free(line);
+  fclose(f);
+  // front-ends stamp records under one lock, so this only fixes up traces
+  // that were cut and pasted together
+  qsort(recs, n, sizeof(record_t), compare_records);
+  *records = recs;
+  *count = n;
+  return 0;
+}
+
+/* Loads replies saved with -o, indexed by connection, with their lengths in
+ * `lens` (replies can be binary). */
+static char **load_replies(const char *path, unsigned long num_conns, size_t **lens) {
+  FILE *f = fopen(path, "r");
+  char *line = NULL;
+  size_t line_cap = 0;
+  char **replies = calloc(num_conns, sizeof(char *));
+  *lens = calloc(num_conns, sizeof(size_t));
+  if (!f || !replies || !*lens) {
+    perror(path);
+    return NULL;
+  }
+  while (getline(&line, &line_cap, f) > 0) {
+    unsigned long conn;
+    int off = 0;
+    if (sscanf(line, "{\"conn\":%lu,\"reply\":\"%n", &conn, &off) < 1 || off == 0 ||
+        conn >= num_conns)
+      continue;
+    free(replies[conn]);
+    replies[conn] = json_unescape(line + off, &(*lens)[conn]);
+  }
+  free(line);
+  fclose(f);
+  return replies;
+}
+
+static void append_reply(replay_conn_t *c, const char *buf, size_t n) {
+  if (c->len + n + 1 > c->cap) {
+    c->cap = (c->len + n + 1) * 2;
+    if ((c->reply = realloc(c->reply, c->cap)) == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  memcpy(c->reply + c->len, buf, n);
+  c->len += n;
+  c->reply[c->len] = '\0';
+}
+
+static void finish_conn(replay_conn_t *c, int *num_open, int failed) {
+  close(c->fd);
+  c->fd = -1;
+  c->done_us = now_us();
+  c->failed |= failed;
+  (*num_open)--;
+}
+
+static int compare_longs(const void *a, const void *b) {
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+static void print_usage(char *program_name) {
+  printf("Usage: %s [-p P] [-s S|max] [-o F] [-e F] trace\n", program_name);
+  printf("  -p: Port the controller is listening on (default: %s).\n", DEFAULT_PORT);
+  printf("  -s: Replay this many times faster than recorded, or 'max' to not wait.\n");
+  printf("  -o: Save every connection's reply to this file.\n");
+  printf("  -e: Compare replies with ones saved by an earlier replay with -o.\n");
+  printf("  -h: Print this help message and exit.\n");
+}
+
+int main(int argc, char *argv[]) {
+  char *port = DEFAULT_PORT, *out_file = NULL, *expected_file = NULL;
+  double speed = 1.0;
+  int c, ret = 0;
+
+  while ((c = getopt(argc, argv, "p:s:o:e:h")) != -1) {
+    switch (c) {
+    case 'p':
+      port = optarg;
+      break;
+    case 's':
+      if (!strcmp(optarg, "max"))
+        speed = 0;
+      else if (sscanf(optarg, "%lf", &speed) != 1 || speed <= 0) {
+        fprintf(stderr, "-s must be greater than 0, or 'max'.\n");
+        return 1;
+      }
+      break;
+    case 'o':
+      out_file = optarg;
+      break;
+    case 'e':
+      expected_file = optarg;
+      break;
+    case 'h':
+      print_usage(argv[0]);
+      return 0;
+    default:
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  size_t num_recs;
+  record_t *recs;
+  if (load_trace(argv[optind], &recs, &num_recs) < 0)
+    return 1;
+
+  unsigned long num_conns = 1;
+  for (size_t i = 0; i < num_recs; i++)
+    if (recs[i].conn >= num_conns)
+      num_conns = recs[i].conn + 1;
+  replay_conn_t *conns = calloc(num_conns, sizeof(replay_conn_t));
+  struct pollfd *fds = calloc(MAX_OPEN, sizeof(struct pollfd));
+  replay_conn_t **polled = calloc(MAX_OPEN, sizeof(replay_conn_t *));
+  if (!conns || !fds || !polled) {
+    perror("calloc");
+    return 1;
+  }
+  for (unsigned long i = 0; i < num_conns; i++)
+    conns[i].fd = -1;
+  for (size_t i = 0; i < num_recs; i++) {
+    replay_conn_t *conn = &conns[recs[i].conn];
+    if (!conn->used) {
+      conn->used = 1;
+      conn->first = i;
+    }
+    conn->last = i;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  long start = now_us();
+  size_t next = 0;
+  int num_open = 0;
+  while (next < num_recs || num_open > 0) {
+    long now = now_us(), wait_us = -1;
+
+    // send whatever is due
+    while (next < num_recs) {
+      record_t *rec = &recs[next];
+      replay_conn_t *conn = &conns[rec->conn];
+      long due = speed > 0 ? (long)((double)rec->t_us / speed) : 0;
+      if (now - start < due) {
+        wait_us = due - (now - start);
+        break;
+      }
+      if (next == conn->first) {
+        if (num_open == MAX_OPEN)
+          break; // wait for one to finish
+        if ((conn->fd = open_clientfd("localhost", port)) < 0) {
+          fprintf(stderr, "Couldn't connect to port %s\n", port);
+          conn->failed = 1;
+          conn->done_us = now;
+        } else
+          num_open++;
+      }
+      if (conn->fd >= 0) {
+        char line[MAXLINE + 2];
+        int n = snprintf(line, sizeof(line), "%s\n", rec->req);
+        if (rio_writen(conn->fd, line, (size_t)n) < 0) {
+          finish_conn(conn, &num_open, 1);
+        } else {
+          conn->active_us = now;
+          if (next == conn->last) {
+            shutdown(conn->fd, SHUT_WR);
+            conn->sent_us = now;
+          }
+        }
+      }
+      next++;
+    }
+
+    // then collect replies until the next request is due
+    int nfds = 0;
+    for (unsigned long i = 0; i < num_conns && nfds < num_open; i++) {
+      if (conns[i].fd < 0)
+        continue;
+      // stalled replies (a WATCH, or a stuck airport) are cut off
+      if (conns[i].sent_us && now - conns[i].active_us > REPLY_TIMEOUT_MS * 1000L) {
+        fprintf(stderr, "Reply on connection %lu timed out\n", i);
+        finish_conn(&conns[i], &num_open, 1);
+        continue;
+      }
+      fds[nfds].fd = conns[i].fd;
+      fds[nfds].events = POLLIN;
+      polled[nfds++] = &conns[i];
+    }
+    int timeout_ms = wait_us < 0 ? 100 : (int)(wait_us / 1000);
+    if (timeout_ms > 100)
+      timeout_ms = 100;
+    if (poll(fds, (nfds_t)nfds, timeout_ms) <= 0)
+      continue;
+    for (int i = 0; i < nfds; i++) {
+      char buf[MAXBUF];
+      if (!fds[i].revents)
+        continue;
+      ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+      if (n > 0) {
+        append_reply(polled[i], buf, (size_t)n);
+        polled[i]->active_us = now_us();
+      } else if (n == 0 || errno != EINTR) {
+        finish_conn(polled[i], &num_open, n < 0);
+      }
+    }
+  }
+  long elapsed = now_us() - start;
+
+  // latency from each connection's last request to the end of its reply
+  long *lat = malloc(sizeof(long) * num_conns);
+  size_t num_lat = 0, used = 0, failed = 0;
+  for (unsigned long i = 0; i < num_conns; i++) {
+    if (!conns[i].used)
+      continue;
+    used++;
+    if (conns[i].failed)
+      failed++;
+    else if (conns[i].sent_us)
+      lat[num_lat++] = conns[i].done_us - conns[i].sent_us;
+  }
+  qsort(lat, num_lat, sizeof(long), compare_longs);
+  printf("replayed %zu requests on %zu connections in %.3fs (%.1f req/s)\n", num_recs, used,
+         (double)elapsed / 1e6, elapsed > 0 ? (double)num_recs * 1e6 / (double)elapsed : 0.0);
+  if (num_lat > 0)
+    printf("latency p50 %.3fms p90 %.3fms p99 %.3fms max %.3fms\n",
+           (double)lat[num_lat / 2] / 1000, (double)lat[num_lat * 9 / 10] / 1000,
+           (double)lat[num_lat * 99 / 100] / 1000, (double)lat[num_lat - 1] / 1000);
+  if (failed > 0) {
+    printf("%zu connections failed\n", failed);
+    ret = 1;
+  }
+
+  if (out_file) {
+    FILE *f = fopen(out_file, "w");
+    if (!f) {
+      perror(out_file);
+      return 1;
+    }
+    for (unsigned long i = 0; i < num_conns; i++) {
+      if (!conns[i].used)
+        continue;
+      char *escaped = malloc(6 * conns[i].len + 1);
+      trace_escape(escaped, conns[i].reply ? conns[i].reply : "", conns[i].len);
+      fprintf(f, "{\"conn\":%lu,\"reply\":\"%s\"}\n", i, escaped);
+      free(escaped);
+    }
+    fclose(f);
+  }
+
+  if (expected_file) {
+    size_t *expected_lens, differ = 0;
+    char **expected = load_replies(expected_file, num_conns, &expected_lens);
+    if (!expected)
+      return 1;
+    for (unsigned long i = 0; i < num_conns; i++) {
+      if (!conns[i].used)
+        continue;
+      if (expected[i] && expected_lens[i] == conns[i].len &&
+          (conns[i].len == 0 || !memcmp(expected[i], conns[i].reply, conns[i].len)))
+        continue;
+      if (differ++ < MAX_REPORTED_DIFFS)
+        printf("connection %lu (first request \"%s\") replied differently\n", i,
+               recs[conns[i].first].req);
+    }
+    printf("%zu of %zu connections replied differently\n", differ, used);
+    if (differ > 0)
+      ret = 1;
+  }
+  return ret;
+}
@@ -0,0 +1,165 @@
+#include "shm_ring.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int ring_init(shm_ring_t *ring) {
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->consumer_asleep, 0);
+  atomic_init(&ring->producer_asleep, 0);
+  ring->data_efd = eventfd(0, EFD_NONBLOCK);
+  ring->space_efd = eventfd(0, EFD_NONBLOCK);
+  if (ring->data_efd < 0 || ring->space_efd < 0)
+    return -1;
+  return 0;
+}
+
+shm_channel_t *shm_channel_create(void) {
+  shm_channel_t *chan = mmap(NULL, sizeof(shm_channel_t), PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (chan == MAP_FAILED)
+    return NULL;
+  if (ring_init(&chan->request) < 0 || ring_init(&chan->response) < 0) {
+    munmap(chan, sizeof(shm_channel_t));
+    return NULL;
+  }
+  return chan;
+}
+
+/* Wakes the other side if it announced it was going to sleep. */
+static void wake(atomic_int *asleep, int efd) {
+  uint64_t one = 1;
+  if (atomic_exchange(asleep, 0))
+    if (write(efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      return;
+}
+
+/* Blocks on `efd` until woken or `deadline` (ms, -1 for none) passes. The
+ * caller must already have set its `asleep` flag and re-checked the ring.
+ * Returns -1 on timeout. */
+static int sleep_on(int efd, long deadline) {
+  struct pollfd pfd = {.fd = efd, .events = POLLIN};
+  uint64_t count;
+  int timeout = -1, rc;
+  if (deadline >= 0) {
+    timeout = (int)(deadline - now_ms());
+    if (timeout < 0)
+      return -1;
+  }
+  while ((rc = poll(&pfd, 1, timeout)) < 0 && errno == EINTR)
+    ;
+  if (rc == 0)
+    return -1;
+  if (read(efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    return -1;
+  return 0;
+}
+
+/* Waits until the ring has room for `count` records. Returns -1 if `deadline`
+ * (ms, -1 for none) passes first. */
+static int wait_for_space(shm_ring_t *ring, unsigned count, long deadline) {
+  unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  unsigned spins = 0;
+  while (SHM_RING_SLOTS - (tail - atomic_load_explicit(&ring->head, memory_order_acquire)) <
+         count) {
+    if (spins++ < SHM_SPIN_LIMIT) {
+      cpu_relax();
+      continue;
+    }
+    atomic_store(&ring->producer_asleep, 1);
+    if (SHM_RING_SLOTS - (tail - atomic_load(&ring->head)) >= count) {
+      atomic_store(&ring->producer_asleep, 0);
+      break;
+    }
+    if (sleep_on(ring->space_efd, deadline) < 0) {
+      atomic_store(&ring->producer_asleep, 0);
+      return -1;
+    }
+    atomic_store(&ring->producer_asleep, 0);
+  }
+  return 0;
+}
+
+static int ring_push(shm_ring_t *ring, const char *data, size_t len, unsigned flags,
+                     long deadline) {
+  if (wait_for_space(ring, 1, deadline) < 0)
+    return -1;
+
+  unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  shm_record_t *rec = &ring->slots[tail & (SHM_RING_SLOTS - 1)];
+  if (len)
+    memcpy(rec->data, data, len);
+  rec->len = (unsigned)len;
+  rec->flags = flags;
+  atomic_store(&ring->tail, tail + 1);
+  wake(&ring->consumer_asleep, ring->data_efd);
+  return 0;
+}
+
+int shm_ring_write(shm_ring_t *ring, const char *usrbuf, size_t n, int end, int timeout_ms) {
+  long deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+  size_t records = n == 0 ? 1 : (n + SHM_RECORD_DATA - 1) / SHM_RECORD_DATA;
+  size_t chunk;
+  // a message that fits goes in whole or not at all, so giving up never leaves
+  // the consumer half of one to run into the next
+  if (timeout_ms >= 0 && records <= SHM_RING_SLOTS &&
+      wait_for_space(ring, (unsigned)records, deadline) < 0)
+    return -1;
+  do {
+    chunk = n < SHM_RECORD_DATA ? n : SHM_RECORD_DATA;
+    n -= chunk;
+    if (ring_push(ring, usrbuf, chunk, (end && n == 0) ? SHM_REC_END : 0, deadline) < 0)
+      return -1;
+    usrbuf += chunk;
+  } while (n > 0);
+  return 0;
+}
+
+ssize_t shm_ring_read(shm_ring_t *ring, char *usrbuf, size_t maxlen, int *end,
+                      int timeout_ms) {
+  unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned spins = 0;
+  long deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+  while (atomic_load_explicit(&ring->tail, memory_order_acquire) == head) {
+    if (spins++ < SHM_SPIN_LIMIT) {
+      cpu_relax();
+      continue;
+    }
+    atomic_store(&ring->consumer_asleep, 1);
+    if (atomic_load(&ring->tail) != head) {
+      atomic_store(&ring->consumer_asleep, 0);
+      break;
+    }
+    if (sleep_on(ring->data_efd, deadline) < 0) {
+      atomic_store(&ring->consumer_asleep, 0);
+      return -1;
+    }
+    atomic_store(&ring->consumer_asleep, 0);
+  }
+
+  shm_record_t *rec = &ring->slots[head & (SHM_RING_SLOTS - 1)];
+  size_t len = rec->len < maxlen ? rec->len : maxlen;
+  memcpy(usrbuf, rec->data, len);
+  *end = (rec->flags & SHM_REC_END) != 0;
+  atomic_store(&ring->head, head + 1);
+  wake(&ring->producer_asleep, ring->space_efd);
+  return (ssize_t)len;
+}
@@ -0,0 +1,84 @@
+#ifndef SHM_RING_HEADER
+#define SHM_RING_HEADER
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/** Shared-memory transport between the controller and its airport children.
+ *
+ *  Each airport gets one `shm_channel_t`, mapped `MAP_SHARED` before the fork
+ *  so that both processes see the same memory. A channel is a pair of
+ *  single-producer/single-consumer rings: the controller produces into
+ *  `request` and consumes `response`, the airport does the opposite.
+ *
+ *  Messages are passed as a sequence of fixed-size records, the last of which
+ *  has `SHM_REC_END` set. Consumers spin briefly before sleeping on an eventfd,
+ *  and producers only write to the eventfd when the consumer is asleep, so an
+ *  uncontended exchange never enters the kernel.
+ */
+
+#define SHM_RECORD_SIZE 128 /* Size of each record, header included */
+#define SHM_RECORD_DATA (SHM_RECORD_SIZE - 2 * sizeof(unsigned))
+#define SHM_RING_SLOTS 64   /* Number of records in a ring (power of two) */
+#define SHM_SPIN_LIMIT 4096 /* Polls of an empty/full ring before sleeping */
+#define SHM_CACHELINE 64
+
+/* Set on the last record of a message. */
+#define SHM_REC_END 1u
+
+typedef struct {
+  unsigned len;   /* Number of bytes used in `data` */
+  unsigned flags; /* `SHM_REC_*` flags */
+  char data[SHM_RECORD_DATA];
+} shm_record_t;
+
+typedef struct {
+  _Alignas(SHM_CACHELINE) atomic_uint head; /* Next record to consume */
+  _Alignas(SHM_CACHELINE) atomic_uint tail; /* Next record to produce */
+  _Alignas(SHM_CACHELINE) atomic_int consumer_asleep;
+  atomic_int producer_asleep;
+  int data_efd;  /* Written by the producer to wake the consumer */
+  int space_efd; /* Written by the consumer to wake the producer */
+  shm_record_t slots[SHM_RING_SLOTS];
+} shm_ring_t;
+
+typedef struct {
+  shm_ring_t request;  /* controller -> airport */
+  shm_ring_t response; /* airport -> controller */
+} shm_channel_t;
+
+/** @brief Maps and initialises a new channel that will be shared with any
+ *         child forked after this call.
+ *
+ *  @returns A pointer to the channel, or `NULL` on failure (errno is set).
+ */
+shm_channel_t *shm_channel_create(void);
+
+/** @brief Appends `n` bytes to the ring, split across as many records as
+ *         needed. If `end` is non-zero, the final record is marked with
+ *         `SHM_REC_END` (an empty end record is sent when `n` is 0).
+ *
+ *         Blocks while the ring is full.
+ *
+ *  @param timeout_ms Milliseconds to wait for room, or -1 to wait forever. A
+ *                    message that fits in the ring is only written once there
+ *                    is room for all of it.
+ *
+ *  @returns 0, or -1 if the timeout expired.
+ */
+int shm_ring_write(shm_ring_t *ring, const char *usrbuf, size_t n, int end, int timeout_ms);
+
+/** @brief Copies the next record out of the ring into `usrbuf`.
+ *
+ *  @param end        Set to 1 if the record terminated a message, else 0.
+ *  @param timeout_ms Milliseconds to wait for a record, or -1 to wait forever.
+ *
+ *  @returns The number of bytes copied, or -1 if the timeout expired.
+ *
+ *  @note `maxlen` must be at least `SHM_RECORD_DATA`.
+ */
+ssize_t shm_ring_read(shm_ring_t *ring, char *usrbuf, size_t maxlen, int *end,
+                      int timeout_ms);
+
+#endif
@@ -0,0 +1,631 @@
+/** Fires randomized concurrent traffic at one airport of a running network and
+ *  checks that what came back is linearizable.
+ *
+ *  Every client thread has a connection of its own to the controller and
+ *  sends SCHEDULEs, PLANE_STATUSes, TIME_STATUSes and TIME_RANGEs one at a
+ *  time, recording when each was sent and when its reply had fully arrived.
+ *  Once they are all done the airport is DUMPed, and the history is checked
+ *  against that final state:
+ *
+ *   - no slot is held by two planes, and every SCHEDULE's reply agrees with
+ *     where (or whether) its plane ended up;
+ *   - every SCHEDULE that placed a plane passed over each earlier gate/slot
+ *     it would have tried because of a plane that could have been placed
+ *     before it (its SCHEDULE started before this one ended), and every one
+ *     that was refused was blocked everywhere like that;
+ *   - every read shows the airport as it was at one instant within its own
+ *     call: each plane it saw could have been placed by then, and each slot
+ *     it saw free could still have been free.
+ *
+ *  No request takes a plane away, so the final state says who held every slot
+ *  and these checks don't have to search for an order. They are the
+ *  conditions any serial order has to meet; a history that fails one can't be
+ *  explained by the requests taking effect one at a time. OPTIMIZE does move
+ *  planes to other gates, though, and then the final state no longer says
+ *  where they were before. A plane that ends up at another gate in its own
+ *  slots is reported as moved, and the run fails with a pointer to `-m`.
+ *
+ *  The airport has to be empty to start with. `-o` saves the history.
+ *
+ *  With `-m` the airport may be moving planes between gates while this runs
+ *  (OPTIMIZE, or a controller started with -O), so the final state no longer
+ *  says which gate a plane was at when something looked at it. Only what
+ *  moving can't change is checked then: every plane keeps the slots it was
+ *  given, nothing is double booked, and no read sees a plane at two gates at
+ *  once or outside its own slots.
+ */
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "airport.h"
+#include "network_utils.h"
+#include "trace.h"
+
+#define DEFAULT_PORT "1024"
+#define MAX_DURATION 6 /* SCHEDULE durations are 0 to this */
+#define MAX_FUEL 8
+#define MAX_WINDOW 8 /* reads look at up to this many slots past their start */
+#define MAX_REPORTED 10
+#define NEVER (1L << 62) /* return time of a request whose outcome is unknown */
+
+typedef enum { OP_SCHEDULE, OP_PLANE_STATUS, OP_TIME_STATUS, OP_TIME_RANGE } op_kind_t;
+
+typedef struct {
+  op_kind_t kind;
+  int plane_id;              /* SCHEDULE, PLANE_STATUS */
+  int start, duration, fuel; /* SCHEDULE; start/duration for the reads too */
+  int gate, last_gate;       /* TIME_STATUS, TIME_RANGE */
+  int client;
+  long call_us, ret_us; /* ret_us is NEVER if the request failed */
+  char req[MAXLINE];
+  char *reply;
+  size_t len;
+} op_t;
+
+typedef struct {
+  int gate, start, end; /* gate -1 if the plane isn't in the final state */
+} placement_t;
+
+static struct {
+  char *port;
+  int airport, num_gates, num_clients, num_ops;
+  int moves; /* planes may be moved between gates (-m) */
+  unsigned seed;
+  long start_us;
+  atomic_int next_plane; /* plane ids are handed out from 1 */
+  op_t *ops;             /* num_ops per client */
+} RUN = {DEFAULT_PORT, 0, 0, 8, 500, 0, 1};
+
+static unsigned long VIOLATIONS = 0;
+/* Planes found at another gate than the one they were scheduled at, in the
+ * slots they were given: something moved them (see -m). */
+static int MOVED = 0;
+
+static long now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void violation(const char *format, ...) {
+  va_list args;
+  if (VIOLATIONS++ >= MAX_REPORTED)
+    return;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+/* The slot an "hh:mm" time starts. */
+static int time_to_idx(int hour, int min) {
+  return hour * 2 + min / 30;
+}
+
+/* Sends `op->req` and reads its whole reply into `op->reply`: as many lines as
+ * the request gets, or one if it is an error. Returns -1 if the connection
+ * broke. */
+static int exchange(int fd, rio_t *rio, op_t *op) {
+  char line[MAXLINE];
+  size_t cap = 0;
+  int n = snprintf(line, sizeof(line), "%s\n", op->req), lines = 1, runs;
+  op->len = 0;
+  if (rio_writen(fd, line, (size_t)n) < 0)
+    return -1;
+  for (int i = 0; i < lines; i++) {
+    ssize_t got = rio_readlineb(rio, line, sizeof(line));
+    if (got <= 0)
+      return -1;
+    if (op->len + (size_t)got + 1 > cap) {
+      cap = (op->len + (size_t)got + 1) * 2;
+      op->reply = realloc(op->reply, cap);
+    }
+    memcpy(op->reply + op->len, line, (size_t)got + 1);
+    op->len += (size_t)got;
+    if (i > 0 || !strncmp(line, "Error", 5))
+      continue;
+    if (op->kind == OP_TIME_STATUS)
+      lines = op->duration + 1;
+    else if (op->kind == OP_TIME_RANGE && sscanf(line, "TIME_RANGE %*d %d", &runs) == 1)
+      lines = runs + 1;
+  }
+  return 0;
+}
+
+/* A random window of up to MAX_WINDOW + 1 slots that fits in the day. */
+static void random_window(unsigned *seed, op_t *op) {
+  op->duration = rand_r(seed) % MAX_WINDOW;
+  op->start = rand_r(seed) % (NUM_TIME_SLOTS - op->duration);
+}
+
+static void make_request(unsigned *seed, op_t *op) {
+  int r = rand_r(seed) % 10;
+  if (r < 5) {
+    op->kind = OP_SCHEDULE;
+    op->plane_id = atomic_fetch_add(&RUN.next_plane, 1) + 1;
+    op->duration = rand_r(seed) % (MAX_DURATION + 1);
+    op->start = rand_r(seed) % (NUM_TIME_SLOTS - op->duration);
+    op->fuel = rand_r(seed) % (MAX_FUEL + 1);
+    snprintf(op->req, sizeof(op->req), "SCHEDULE %d %d %d %d %d", RUN.airport, op->plane_id,
+             op->start, op->duration, op->fuel);
+  } else if (r < 7) {
+    // any plane handed out so far, or the next one
+    op->kind = OP_PLANE_STATUS;
+    op->plane_id = rand_r(seed) % (atomic_load(&RUN.next_plane) + 1) + 1;
+    snprintf(op->req, sizeof(op->req), "PLANE_STATUS %d %d", RUN.airport, op->plane_id);
+  } else if (r < 9) {
+    op->kind = OP_TIME_STATUS;
+    op->gate = rand_r(seed) % RUN.num_gates;
+    random_window(seed, op);
+    snprintf(op->req, sizeof(op->req), "TIME_STATUS %d %d %d %d", RUN.airport, op->gate,
+             op->start, op->duration);
+  } else {
+    op->kind = OP_TIME_RANGE;
+    op->gate = rand_r(seed) % RUN.num_gates;
+    op->last_gate = op->gate + rand_r(seed) % (RUN.num_gates - op->gate);
+    random_window(seed, op);
+    snprintf(op->req, sizeof(op->req), "TIME_RANGE %d %d %d %d %d", RUN.airport, op->gate,
+             op->last_gate, op->start, op->duration);
+  }
+}
+
+static void *client_thread(void *arg) {
+  int client = (int)(long)arg, fd = -1;
+  unsigned seed = RUN.seed * 7919 + (unsigned)client;
+  rio_t rio;
+  for (int i = 0; i < RUN.num_ops; i++) {
+    op_t *op = &RUN.ops[client * RUN.num_ops + i];
+    op->client = client;
+    make_request(&seed, op);
+    if (fd < 0 && (fd = open_clientfd("localhost", RUN.port)) >= 0)
+      rio_readinitb(&rio, fd);
+    op->call_us = now_us() - RUN.start_us;
+    if (fd < 0 || exchange(fd, &rio, op) < 0) {
+      // it may or may not have happened
+      op->ret_us = NEVER;
+      op->len = 0;
+      if (fd >= 0)
+        close(fd);
+      fd = -1;
+      continue;
+    }
+    op->ret_us = now_us() - RUN.start_us;
+  }
+  if (fd >= 0)
+    close(fd);
+  return NULL;
+}
+
+/* Sends `request` on a connection of its own and returns everything that
+ * comes back until EOF (free it), or NULL if nothing does. */
+static char *request_once(const char *request) {
+  char line[MAXLINE], *reply = NULL;
+  size_t len = 0, cap = 0;
+  ssize_t got;
+  rio_t rio;
+  int fd = open_clientfd("localhost", RUN.port);
+  if (fd < 0)
+    return NULL;
+  int n = snprintf(line, sizeof(line), "%s\n", request);
+  if (rio_writen(fd, line, (size_t)n) < 0) {
+    close(fd);
+    return NULL;
+  }
+  shutdown(fd, SHUT_WR);
+  rio_readinitb(&rio, fd);
+  while ((got = rio_readlineb(&rio, line, sizeof(line))) > 0) {
+    if (len + (size_t)got + 1 > cap) {
+      cap = (len + (size_t)got + 1) * 2;
+      reply = realloc(reply, cap);
+    }
+    memcpy(reply + len, line, (size_t)got + 1);
+    len += (size_t)got;
+  }
+  close(fd);
+  return reply;
+}
+
+/* Reads the final state from `DUMP`: where every plane is, and who holds
+ * every slot (0 for nobody). Returns -1 if the DUMP can't be read. */
+static int load_final_state(placement_t *placed, int max_plane, int *owner) {
+  char request[MAXLINE];
+  snprintf(request, sizeof(request), "DUMP %d TEXT", RUN.airport);
+  char *dump = request_once(request), *line, *save;
+  int count, gate, plane_id, start, end;
+  if (!dump || sscanf(dump, "DUMP %*d %d", &count) != 1) {
+    fprintf(stderr, "Couldn't DUMP airport %d: %s", RUN.airport, dump ? dump : "no reply\n");
+    return -1;
+  }
+  strtok_r(dump, "\n", &save);
+  while ((line = strtok_r(NULL, "\n", &save)) != NULL) {
+    if (sscanf(line, "%d %d %d %d", &gate, &plane_id, &start, &end) != 4)
+      continue;
+    if (plane_id < 1 || plane_id > max_plane) {
+      violation("plane %d is at gate %d but was never scheduled\n", plane_id, gate);
+      continue;
+    }
+    if (gate < 0 || gate >= RUN.num_gates || start < 0 || end < start || end >= NUM_TIME_SLOTS) {
+      violation("plane %d is at gate %d slots %d-%d, outside the airport\n", plane_id, gate, start,
+                end);
+      continue;
+    }
+    placed[plane_id] = (placement_t){gate, start, end};
+    for (int s = start; s <= end; s++) {
+      int *slot = &owner[gate * NUM_TIME_SLOTS + s];
+      if (*slot)
+        violation("gate %d slot %d is held by both plane %d and plane %d\n", gate, s, *slot,
+                  plane_id);
+      else
+        *slot = plane_id;
+    }
+  }
+  free(dump);
+  return 0;
+}
+
+/* The SCHEDULE that placed each plane. */
+static op_t **index_schedules(int max_plane) {
+  op_t **by_plane = calloc((size_t)max_plane + 1, sizeof(op_t *));
+  for (int i = 0; i < RUN.num_clients * RUN.num_ops; i++)
+    if (RUN.ops[i].kind == OP_SCHEDULE)
+      by_plane[RUN.ops[i].plane_id] = &RUN.ops[i];
+  return by_plane;
+}
+
+/* 1 if something other than `op`'s plane, which could have been placed
+ * before `op` took effect, holds a slot of `gate` between `start` and `end`. */
+static int blocked(op_t *op, op_t **by_plane, int *owner, int gate, int start, int end) {
+  for (int s = start; s <= end; s++) {
+    int holder = owner[gate * NUM_TIME_SLOTS + s];
+    if (holder && holder != op->plane_id && by_plane[holder]->call_us < op->ret_us)
+      return 1;
+  }
+  return 0;
+}
+
+static void check_schedule(op_t *op, placement_t *placed, op_t **by_plane, int *owner) {
+  placement_t *p = &placed[op->plane_id];
+  int gate, start, end, hour, min;
+  if (op->ret_us != NEVER) {
+    if (sscanf(op->reply, "SCHEDULED %*d at GATE %d: %d:%d", &gate, &hour, &min) == 3) {
+      start = time_to_idx(hour, min);
+      if (!RUN.moves && p->gate >= 0 && p->gate != gate && p->start == start &&
+          p->end == start + op->duration) {
+        MOVED++;
+        violation("\"%s\" replied %.*s but the plane was moved to gate %d\n", op->req,
+                  (int)op->len - 1, op->reply, p->gate);
+        return; // the gates it was turned away from may have changed too
+      }
+      if ((p->gate != gate && !RUN.moves) || p->start != start ||
+          p->end != start + op->duration)
+        violation("\"%s\" replied %.*s but the plane is at gate %d slots %d-%d\n", op->req,
+                  (int)op->len - 1, op->reply, p->gate, p->start, p->end);
+    } else if (!strncmp(op->reply, "Error: Cannot schedule", 22)) {
+      if (p->gate >= 0)
+        violation("\"%s\" was refused but the plane is at gate %d slots %d-%d\n", op->req,
+                  p->gate, p->start, p->end);
+    } else {
+      if (p->gate >= 0)
+        violation("\"%s\" replied %.*s but the plane is at gate %d slots %d-%d\n", op->req,
+                  (int)op->len - 1, op->reply, p->gate, p->start, p->end);
+      return;
+    }
+  } else if (p->gate < 0) {
+    return; // it failed and may never have got to the airport
+  }
+
+  // try every gate and slot in the order the airport does, up to where it
+  // ended up
+  int latest = op->start + op->fuel;
+  if (latest + op->duration >= NUM_TIME_SLOTS)
+    latest = NUM_TIME_SLOTS - 1 - op->duration;
+  if (p->gate >= 0 && (p->start < op->start || p->start > latest ||
+                       p->end != p->start + op->duration)) {
+    violation("\"%s\" placed its plane at gate %d slots %d-%d, which it can't\n", op->req,
+              p->gate, p->start, p->end);
+    return;
+  }
+  // the gates it was turned away from may have been rearranged since
+  if (RUN.moves)
+    return;
+  for (gate = 0; gate < RUN.num_gates; gate++) {
+    for (start = op->start; start <= latest; start++) {
+      if (gate == p->gate && start == p->start)
+        return;
+      end = start + op->duration;
+      if (!blocked(op, by_plane, owner, gate, start, end)) {
+        violation("\"%s\" %s, but gate %d slots %d-%d were free of anything placed before it\n",
+                  op->req, p->gate >= 0 ? "went later" : "was refused", gate, start, end);
+        return;
+      }
+    }
+  }
+}
+
+/* Narrows the instant a read took effect at, [*lo, *hi], by one slot it saw:
+ * held by `seen` (0 if free). */
+static void see_slot(op_t *op, op_t **by_plane, int *owner, int gate, int slot, int seen,
+                     long *lo, long *hi) {
+  int holder = owner[gate * NUM_TIME_SLOTS + slot];
+  if (seen) {
+    if (holder != seen) {
+      violation("\"%s\" saw plane %d at gate %d slot %d, which it never held\n", op->req, seen,
+                gate, slot);
+      return;
+    }
+    if (by_plane[seen]->call_us > *lo)
+      *lo = by_plane[seen]->call_us;
+  } else if (holder && by_plane[holder]->ret_us < *hi) {
+    *hi = by_plane[holder]->ret_us;
+  }
+}
+
+static void check_window(op_t *op, int gate, long lo, long hi) {
+  if (lo > hi)
+    violation("\"%s\" (%ld-%ldus) saw gate %d at no single instant: it saw a plane placed from "
+              "%ldus and missed one in place by %ldus\n",
+              op->req, op->call_us, op->ret_us, gate, lo, hi);
+}
+
+/* check_read's TIME_STATUS and TIME_RANGE checks for -m: every plane seen
+ * has to be in its own slots, at one gate only. */
+static void check_moved_read(op_t *op, char *reply, placement_t *placed) {
+  char *line, *save;
+  int gate, plane_id, first, last, hour, min, max_plane = atomic_load(&RUN.next_plane);
+  char status;
+  int *seen_at = malloc(sizeof(int) * ((size_t)max_plane + 1));
+  for (int i = 0; i <= max_plane; i++)
+    seen_at[i] = -1;
+  for (line = strtok_r(reply, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+    plane_id = 0;
+    if (op->kind == OP_TIME_STATUS) {
+      if (sscanf(line, "AIRPORT %*d GATE %d %d:%d: %c - %d", &gate, &hour, &min, &status,
+                 &plane_id) != 5)
+        continue;
+      first = last = time_to_idx(hour, min);
+    } else if (sscanf(line, "%d %d %d %c %d", &gate, &first, &last, &status, &plane_id) < 4) {
+      continue;
+    }
+    if (status != 'A')
+      continue;
+    if (plane_id < 1 || plane_id > max_plane || placed[plane_id].gate < 0 ||
+        first < placed[plane_id].start || last > placed[plane_id].end) {
+      violation("\"%s\" saw plane %d at gate %d slots %d-%d, which it never held\n", op->req,
+                plane_id, gate, first, last);
+      continue;
+    }
+    if (seen_at[plane_id] >= 0 && seen_at[plane_id] != gate)
+      violation("\"%s\" saw plane %d at gates %d and %d at once\n", op->req, plane_id,
+                seen_at[plane_id], gate);
+    seen_at[plane_id] = gate;
+  }
+  free(seen_at);
+}
+
+static void check_read(op_t *op, placement_t *placed, op_t **by_plane, int *owner) {
+  char *line, *save;
+  int gate, plane_id, first, last, hour, min;
+  char status;
+  long lo = op->call_us, hi = op->ret_us;
+  if (op->ret_us == NEVER || !strncmp(op->reply, "Error", 5))
+    return;
+
+  if (op->kind == OP_PLANE_STATUS) {
+    // it may have asked for the plane after the last one handed out
+    placement_t *p = op->plane_id <= atomic_load(&RUN.next_plane) ? &placed[op->plane_id] : NULL;
+    if (sscanf(op->reply, "PLANE %*d scheduled at GATE %d: %d:%d", &gate, &hour, &min) == 3) {
+      if (!p || (p->gate != gate && !RUN.moves) || p->start != time_to_idx(hour, min))
+        violation("\"%s\" replied %.*s, which isn't where it is\n", op->req, (int)op->len - 1,
+                  op->reply);
+      else if (by_plane[op->plane_id]->call_us > op->ret_us)
+        violation("\"%s\" saw plane %d before it was scheduled\n", op->req, op->plane_id);
+    } else if (p && p->gate >= 0 && by_plane[op->plane_id]->ret_us < op->call_us) {
+      violation("\"%s\" didn't find plane %d, placed by %ldus, at %ldus\n", op->req,
+                op->plane_id, by_plane[op->plane_id]->ret_us, op->call_us);
+    }
+    return;
+  }
+
+  char *reply = strdup(op->reply);
+  if (RUN.moves) {
+    check_moved_read(op, reply, placed);
+  } else if (op->kind == OP_TIME_STATUS) {
+    for (line = strtok_r(reply, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+      if (sscanf(line, "AIRPORT %*d GATE %d %d:%d: %c - %d", &gate, &hour, &min, &status,
+                 &plane_id) != 5)
+        continue;
+      see_slot(op, by_plane, owner, gate, time_to_idx(hour, min), status == 'A' ? plane_id : 0,
+               &lo, &hi);
+    }
+    check_window(op, op->gate, lo, hi);
+  } else {
+    // each gate is read at an instant of its own
+    int current = -1;
+    strtok_r(reply, "\n", &save);
+    while ((line = strtok_r(NULL, "\n", &save)) != NULL) {
+      plane_id = 0;
+      if (sscanf(line, "%d %d %d %c %d", &gate, &first, &last, &status, &plane_id) < 4)
+        continue;
+      if (gate != current) {
+        if (current >= 0)
+          check_window(op, current, lo, hi);
+        current = gate;
+        lo = op->call_us;
+        hi = op->ret_us;
+      }
+      for (int s = first; s <= last; s++)
+        see_slot(op, by_plane, owner, gate, s, status == 'A' ? plane_id : 0, &lo, &hi);
+    }
+    if (current >= 0)
+      check_window(op, current, lo, hi);
+  }
+  free(reply);
+}
+
+/* Works out how many gates the (empty) airport has. */
+static int count_gates(void) {
+  char request[MAXLINE];
+  snprintf(request, sizeof(request), "DUMP %d TEXT", RUN.airport);
+  char *dump = request_once(request);
+  int count = -1;
+  if (!dump || sscanf(dump, "DUMP %*d %d", &count) != 1 || count != 0) {
+    fprintf(stderr, "Airport %d has to be up and empty: %s", RUN.airport,
+            dump ? dump : "no reply\n");
+    free(dump);
+    return -1;
+  }
+  free(dump);
+  snprintf(request, sizeof(request), "GATES_FREE %d 0 %d", RUN.airport, NUM_TIME_SLOTS - 1);
+  char *free_gates = request_once(request), *colon;
+  if (!free_gates || !(colon = strrchr(free_gates, ':'))) {
+    fprintf(stderr, "Couldn't list the gates of airport %d\n", RUN.airport);
+    free(free_gates);
+    return -1;
+  }
+  count = 0;
+  for (char *tok = strtok(colon + 1, " \n"); tok; tok = strtok(NULL, " \n"))
+    count++;
+  free(free_gates);
+  return count;
+}
+
+static void print_usage(char *program_name) {
+  printf("Usage: %s [-p P] [-a A] [-c C] [-n N] [-s S] [-m] [-o F]\n", program_name);
+  printf("  -p: Port the controller is listening on (default: %s).\n", DEFAULT_PORT);
+  printf("  -a: Airport to send the traffic to, which has to be empty (default: 0).\n");
+  printf("  -c: Number of concurrent clients (default: 8).\n");
+  printf("  -n: Number of requests each client sends (default: 500).\n");
+  printf("  -s: Seed for the random requests (default: 1).\n");
+  printf("  -m: Planes may be moved between gates (OPTIMIZE), don't check gates.\n");
+  printf("  -o: Save the history (every request, its reply and timing) to this file.\n");
+  printf("  -h: Print this help message and exit.\n");
+}
+
+int main(int argc, char *argv[]) {
+  char *out_file = NULL;
+  int c;
+
+  while ((c = getopt(argc, argv, "p:a:c:n:s:mo:h")) != -1) {
+    switch (c) {
+    case 'p':
+      RUN.port = optarg;
+      break;
+    case 'a':
+      if (sscanf(optarg, "%d", &RUN.airport) != 1 || RUN.airport < 0) {
+        fprintf(stderr, "-a must be an airport number.\n");
+        return 1;
+      }
+      break;
+    case 'c':
+      if (sscanf(optarg, "%d", &RUN.num_clients) != 1 || RUN.num_clients < 1) {
+        fprintf(stderr, "-c must be at least 1.\n");
+        return 1;
+      }
+      break;
+    case 'n':
+      if (sscanf(optarg, "%d", &RUN.num_ops) != 1 || RUN.num_ops < 1) {
+        fprintf(stderr, "-n must be at least 1.\n");
+        return 1;
+      }
+      break;
+    case 's':
+      if (sscanf(optarg, "%u", &RUN.seed) != 1) {
+        fprintf(stderr, "-s must be a number.\n");
+        return 1;
+      }
+      break;
+    case 'm':
+      RUN.moves = 1;
+      break;
+    case 'o':
+      out_file = optarg;
+      break;
+    case 'h':
+      print_usage(argv[0]);
+      return 0;
+    default:
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  if ((RUN.num_gates = count_gates()) <= 0)
+    return 1;
+  int total = RUN.num_clients * RUN.num_ops;
+  pthread_t *threads = calloc((size_t)RUN.num_clients, sizeof(pthread_t));
+  if (!threads || !(RUN.ops = calloc((size_t)total, sizeof(op_t)))) {
+    perror("calloc");
+    return 1;
+  }
+
+  RUN.start_us = now_us();
+  for (long i = 0; i < RUN.num_clients; i++)
+    pthread_create(&threads[i], NULL, client_thread, (void *)i);
+  for (int i = 0; i < RUN.num_clients; i++)
+    pthread_join(threads[i], NULL);
+  long elapsed = now_us() - RUN.start_us;
+
+  if (out_file) {
+    FILE *f = fopen(out_file, "w");
+    if (!f) {
+      perror(out_file);
+      return 1;
+    }
+    for (int i = 0; i < total; i++) {
+      op_t *op = &RUN.ops[i];
+      char *escaped = malloc(6 * op->len + 1);
+      trace_escape(escaped, op->reply ? op->reply : "", op->len);
+      fprintf(f, "{\"client\":%d,\"call_us\":%ld,\"ret_us\":%ld,\"req\":\"%s\",\"reply\":\"%s\"}\n",
+              op->client, op->call_us, op->ret_us == NEVER ? -1 : op->ret_us, op->req, escaped);
+      free(escaped);
+    }
+    fclose(f);
+  }
+
+  int max_plane = atomic_load(&RUN.next_plane);
+  placement_t *placed = malloc(sizeof(placement_t) * ((size_t)max_plane + 1));
+  int *owner = calloc((size_t)RUN.num_gates * NUM_TIME_SLOTS, sizeof(int));
+  for (int i = 0; i <= max_plane; i++)
+    placed[i] = (placement_t){-1, -1, -1};
+  if (load_final_state(placed, max_plane, owner) < 0)
+    return 1;
+  op_t **by_plane = index_schedules(max_plane);
+
+  int failed = 0, scheduled = 0, refused = 0;
+  for (int i = 0; i < total; i++) {
+    op_t *op = &RUN.ops[i];
+    if (op->ret_us == NEVER)
+      failed++;
+    if (op->kind == OP_SCHEDULE) {
+      if (placed[op->plane_id].gate >= 0)
+        scheduled++;
+      else if (op->ret_us != NEVER && !strncmp(op->reply, "Error: Cannot", 13))
+        refused++;
+      check_schedule(op, placed, by_plane, owner);
+    } else {
+      check_read(op, placed, by_plane, owner);
+    }
+  }
+
+  printf("%d requests from %d clients to %d gates in %.3fs (%.1f req/s)\n", total,
+         RUN.num_clients, RUN.num_gates, (double)elapsed / 1e6,
+         elapsed > 0 ? (double)total * 1e6 / (double)elapsed : 0.0);
+  printf("%d planes placed, %d refused, %d requests failed\n", scheduled, refused, failed);
+  if (MOVED > 0)
+    printf("%d planes were moved between gates, use -m if the airport is being optimized\n",
+           MOVED);
+  if (VIOLATIONS > 0) {
+    printf("%lu violations, the history is not linearizable\n", VIOLATIONS);
+    return 1;
+  }
+  printf("no violations, the history is linearizable\n");
+  return 0;
+}
@@ -0,0 +1,162 @@
+#include "trace.h"
+#include "network_utils.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+static struct {
+  int fd;                     /* -1 when not recording */
+  char *bufs[2];              /* front-ends fill one, the writer empties the other */
+  int active;                 /* the one being filled */
+  size_t len;                 /* bytes in the active buffer */
+  unsigned long dropped;      /* records that didn't fit since the last swap */
+  long start_us;
+  pthread_mutex_t lock;       /* guards the fields above */
+  pthread_mutex_t write_lock; /* held while a buffer is written to the file */
+  pthread_cond_t half_full;
+} TRACE = {-1, {NULL, NULL}, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER};
+
+static atomic_ulong NEXT_CONN;
+
+static long now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+size_t trace_escape(char *dst, const char *src, size_t n) {
+  static const char hex[] = "0123456789abcdef";
+  size_t len = 0;
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = (unsigned char)src[i];
+    if (c == '"' || c == '\\') {
+      dst[len++] = '\\';
+      dst[len++] = (char)c;
+    } else if (c == '\n') {
+      dst[len++] = '\\';
+      dst[len++] = 'n';
+    } else if (c < 0x20 || c == 0x7f) {
+      memcpy(dst + len, "\\u00", 4);
+      dst[len + 4] = hex[c >> 4];
+      dst[len + 5] = hex[c & 0xf];
+      len += 6;
+    } else {
+      dst[len++] = (char)c;
+    }
+  }
+  dst[len] = '\0';
+  return len;
+}
+
+/* Swaps the buffers and writes out the one that was being filled. */
+static void swap_and_write(void) {
+  char marker[64];
+  pthread_mutex_lock(&TRACE.write_lock);
+  pthread_mutex_lock(&TRACE.lock);
+  char *buf = TRACE.bufs[TRACE.active];
+  size_t len = TRACE.len;
+  unsigned long dropped = TRACE.dropped;
+  TRACE.active ^= 1;
+  TRACE.len = 0;
+  TRACE.dropped = 0;
+  pthread_mutex_unlock(&TRACE.lock);
+
+  // the records we dropped came after everything that was buffered
+  if (len > 0 && rio_writen(TRACE.fd, buf, len) < 0)
+    perror("[Trace] write");
+  if (dropped > 0) {
+    int n = snprintf(marker, sizeof(marker), "{\"dropped\":%lu}\n", dropped);
+    if (rio_writen(TRACE.fd, marker, (size_t)n) < 0)
+      perror("[Trace] write");
+  }
+  pthread_mutex_unlock(&TRACE.write_lock);
+}
+
+static void *trace_writer_thread(void *arg) {
+  struct timespec deadline;
+  while (1) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += TRACE_FLUSH_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    pthread_mutex_lock(&TRACE.lock);
+    while (TRACE.len < TRACE_BUFSIZE / 2 &&
+           pthread_cond_timedwait(&TRACE.half_full, &TRACE.lock, &deadline) == 0)
+      ;
+    int empty = TRACE.len == 0 && TRACE.dropped == 0;
+    pthread_mutex_unlock(&TRACE.lock);
+    if (!empty)
+      swap_and_write();
+  }
+  return NULL;
+}
+
+int trace_open(const char *path) {
+  pthread_condattr_t attr;
+  pthread_t writer;
+
+  TRACE.bufs[0] = malloc(TRACE_BUFSIZE);
+  TRACE.bufs[1] = malloc(TRACE_BUFSIZE);
+  if (!TRACE.bufs[0] || !TRACE.bufs[1]) {
+    errno = ENOMEM;
+    return -1;
+  }
+  if ((TRACE.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+    return -1;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&TRACE.half_full, &attr);
+  pthread_condattr_destroy(&attr);
+  TRACE.start_us = now_us();
+
+  int rc = pthread_create(&writer, NULL, trace_writer_thread, NULL);
+  if (rc != 0) {
+    close(TRACE.fd);
+    TRACE.fd = -1;
+    errno = rc;
+    return -1;
+  }
+  pthread_detach(writer);
+  atexit(trace_flush);
+  return 0;
+}
+
+int trace_enabled(void) {
+  return TRACE.fd >= 0;
+}
+
+unsigned long trace_new_connection(void) {
+  return atomic_fetch_add(&NEXT_CONN, 1) + 1;
+}
+
+void trace_request(unsigned long conn, const char *line) {
+  char escaped[6 * MAXLINE + 1], record[6 * MAXLINE + 64];
+  size_t n = strlen(line);
+  if (TRACE.fd < 0)
+    return;
+  if (n > 0 && line[n - 1] == '\n')
+    n--;
+  if (n > MAXLINE)
+    n = MAXLINE;
+  trace_escape(escaped, line, n);
+
+  pthread_mutex_lock(&TRACE.lock);
+  // stamped under the lock, so the file is in time order
+  int len = snprintf(record, sizeof(record), "{\"t_us\":%ld,\"conn\":%lu,\"req\":\"%s\"}\n",
+                     now_us() - TRACE.start_us, conn, escaped);
+  if (TRACE.len + (size_t)len > TRACE_BUFSIZE) {
+    TRACE.dropped++;
+  } else {
+    memcpy(TRACE.bufs[TRACE.active] + TRACE.len, record, (size_t)len);
+    TRACE.len += (size_t)len;
+    if (TRACE.len >= TRACE_BUFSIZE / 2)
+      pthread_cond_signal(&TRACE.half_full);
+  }
+  pthread_mutex_unlock(&TRACE.lock);
+}
+
+void trace_flush(void) {
+  if (TRACE.fd >= 0)
+    swap_and_write();
+}
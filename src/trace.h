@@ -0,0 +1,52 @@
+#ifndef TRACE_HEADER
+#define TRACE_HEADER
+
+#include <stddef.h>
+
+/** Traffic recording for the controller (`-T`).
+ *
+ *  Every request line a client sends is written to a JSON Lines file, one
+ *  object per request:
+ *
+ *      {"t_us":1520,"conn":3,"req":"SCHEDULE 0 17 4 2 10"}
+ *
+ *  `t_us` is microseconds since recording started and `conn` numbers client
+ *  connections from 1 in the order they sent their first request, so a trace
+ *  can be replayed with the same connections and timing (see `src/replay.c`).
+ *
+ *  Front-ends only copy the record into a shared buffer. A writer thread swaps
+ *  it for a second one and writes it out every `TRACE_FLUSH_MS`, or sooner
+ *  once it's half full. If the writer falls so far behind that the buffer
+ *  fills up, records are dropped rather than holding up requests, and a
+ *  `{"dropped":<n>}` line marks the gap.
+ */
+
+#define TRACE_BUFSIZE (1 << 20) /* Bytes buffered on each side */
+#define TRACE_FLUSH_MS 100      /* Longest a record waits to be written */
+
+/** @brief Starts recording to `path` (truncated) and starts the writer.
+ *
+ *  @returns 0 on success, -1 on error (errno set).
+ */
+int trace_open(const char *path);
+
+/** @brief Returns 1 if requests are being recorded. */
+int trace_enabled(void);
+
+/** @brief Returns a new connection number for the trace. */
+unsigned long trace_new_connection(void);
+
+/** @brief Records one request line (a trailing newline is left out). */
+void trace_request(unsigned long conn, const char *line);
+
+/** @brief Writes out everything recorded so far. */
+void trace_flush(void);
+
+/** @brief Writes `n` bytes of `src` to `dst` as the inside of a JSON string,
+ *         NUL terminated. `dst` must have room for `6 * n + 1` bytes.
+ *
+ *  @returns The length of the escaped string.
+ */
+size_t trace_escape(char *dst, const char *src, size_t n);
+
+#endif
@@ -0,0 +1,223 @@
+#include "uring_io.h"
+#include "network_utils.h"
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+/* user_data of the accept submission; reads use their connection slot. */
+#define UD_ACCEPT ((__u64)-1)
+
+typedef struct {
+  int ring_fd;
+  unsigned sq_entries;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned to_submit;
+} uring_t;
+
+// one connection being read from, using slice `slot` of the buffer pool
+typedef struct {
+  int fd;     /* -1 when the slot is free */
+  size_t len; /* bytes of a partial line sitting in the buffer */
+} uring_conn_t;
+
+static int uring_setup(uring_t *ring) {
+  struct io_uring_params p;
+  size_t sq_size, cq_size;
+  char *sq_ptr, *cq_ptr;
+
+  memset(&p, 0, sizeof(p));
+  if ((ring->ring_fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0)
+    return -1;
+
+  sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+
+  sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring->ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED)
+    return -1;
+  cq_ptr = sq_ptr;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring->ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED)
+      return -1;
+  }
+  ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->ring_fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    return -1;
+
+  ring->sq_entries = p.sq_entries;
+  ring->sq_head = (unsigned *)(sq_ptr + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq_ptr + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq_ptr + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq_ptr + p.sq_off.array);
+  ring->cq_head = (unsigned *)(cq_ptr + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq_ptr + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq_ptr + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+  ring->to_submit = 0;
+  return 0;
+}
+
+/* Submits everything queued so far and waits for `wait_nr` completions. */
+static int uring_enter(uring_t *ring, unsigned wait_nr) {
+  int rc;
+  do {
+    rc = (int)syscall(__NR_io_uring_enter, ring->ring_fd, ring->to_submit, wait_nr,
+                      wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (rc < 0 && errno == EINTR);
+  if (rc >= 0)
+    ring->to_submit -= (unsigned)rc < ring->to_submit ? (unsigned)rc : ring->to_submit;
+  return rc;
+}
+
+/* Returns a zeroed submission entry, flushing the queue first if it's full.
+ * It becomes visible to the kernel on the next `uring_enter`. */
+static struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+  unsigned tail = *ring->sq_tail;
+  while (tail - atomic_load_explicit((_Atomic unsigned *)ring->sq_head,
+                                     memory_order_acquire) >= ring->sq_entries)
+    uring_enter(ring, 0);
+  unsigned idx = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[idx] = idx;
+  atomic_store_explicit((_Atomic unsigned *)ring->sq_tail, tail + 1, memory_order_release);
+  ring->to_submit++;
+  return sqe;
+}
+
+static void queue_accept(uring_t *ring, int listenfd, int multishot) {
+  struct io_uring_sqe *sqe = uring_get_sqe(ring);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listenfd;
+  sqe->ioprio = multishot ? IORING_ACCEPT_MULTISHOT : 0;
+  sqe->user_data = UD_ACCEPT;
+}
+
+static void queue_read(uring_t *ring, uring_conn_t *conn, char *buf, unsigned slot) {
+  struct io_uring_sqe *sqe = uring_get_sqe(ring);
+  sqe->opcode = IORING_OP_READ_FIXED;
+  sqe->fd = conn->fd;
+  sqe->addr = (__u64)(uintptr_t)(buf + conn->len);
+  sqe->len = (unsigned)(MAXLINE - 1 - conn->len);
+  sqe->buf_index = 0; // the whole pool is registered as one region
+  sqe->user_data = slot;
+}
+
+/* Hands every complete line in the connection's buffer to `on_line`.
+ * Returns 0 if the callback took the connection, 1 to keep reading. */
+static int deliver_lines(uring_conn_t *conn, char *buf, uring_line_fn on_line, void *arg) {
+  char *start = buf, *nl;
+  size_t left = conn->len;
+  while ((nl = memchr(start, '\n', left)) != NULL || left == MAXLINE - 1) {
+    // an overlong line is handed over in MAXLINE pieces, like rio_readlineb
+    char *end = nl ? nl + 1 : start + left;
+    char saved = *end;
+    *end = '\0';
+    int keep = on_line(conn->fd, start, arg);
+    *end = saved;
+    left -= (size_t)(end - start);
+    start = end;
+    if (!keep)
+      return 0;
+  }
+  memmove(buf, start, left);
+  conn->len = left;
+  return 1;
+}
+
+int uring_serve(int listenfd, uring_line_fn on_line, uring_close_fn on_close, void *arg) {
+  // per call rather than static, every front-end thread runs its own loop
+  uring_conn_t *conns = calloc(URING_MAX_CONNS, sizeof(uring_conn_t));
+  char (*bufs)[MAXLINE] = calloc(URING_MAX_CONNS, MAXLINE);
+  struct iovec iov = {bufs, URING_MAX_CONNS * MAXLINE};
+  uring_t ring;
+  int multishot = 1;
+
+  if (!conns || !bufs || uring_setup(&ring) < 0) {
+    free(conns);
+    free(bufs);
+    return -1;
+  }
+  // one registered region, each connection reads into its own MAXLINE slice
+  // of it (buf_index just has to name the region containing the address)
+  if (syscall(__NR_io_uring_register, ring.ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0) {
+    close(ring.ring_fd);
+    free(conns);
+    free(bufs);
+    return -1;
+  }
+  for (int i = 0; i < URING_MAX_CONNS; i++)
+    conns[i].fd = -1;
+
+  queue_accept(&ring, listenfd, multishot);
+  while (1) {
+    if (uring_enter(&ring, 1) < 0)
+      continue;
+
+    unsigned head = *ring.cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)ring.cq_tail,
+                                         memory_order_acquire);
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+      __u64 ud = cqe->user_data;
+      int res = cqe->res;
+
+      if (ud == UD_ACCEPT) {
+        if (res == -EINVAL && multishot) {
+          multishot = 0; // older kernel, re-arm after every connection instead
+        } else if (res >= 0) {
+          unsigned slot;
+          for (slot = 0; slot < URING_MAX_CONNS && conns[slot].fd >= 0; slot++)
+            ;
+          if (slot == URING_MAX_CONNS) {
+            fprintf(stderr, "[uring] Too many connections, dropping one\n");
+            close(res);
+          } else {
+            conns[slot].fd = res;
+            conns[slot].len = 0;
+            queue_read(&ring, &conns[slot], bufs[slot], slot);
+          }
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+          queue_accept(&ring, listenfd, multishot);
+        continue;
+      }
+
+      uring_conn_t *conn = &conns[ud];
+      if (res <= 0) { // EOF or error, we're done with this one
+        int keep = 1;
+        if (res == 0 && conn->len > 0) { // last line had no newline
+          bufs[ud][conn->len] = '\0';
+          keep = on_line(conn->fd, bufs[ud], arg);
+        }
+        if (keep) {
+          if (on_close)
+            on_close(conn->fd, arg);
+          close(conn->fd);
+        }
+        conn->fd = -1;
+        continue;
+      }
+      conn->len += (size_t)res;
+      if (deliver_lines(conn, bufs[ud], on_line, arg))
+        queue_read(&ring, conn, bufs[ud], (unsigned)ud);
+      else
+        conn->fd = -1;
+    }
+    atomic_store_explicit((_Atomic unsigned *)ring.cq_head, head, memory_order_release);
+  }
+  return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef URING_IO_HEADER
+#define URING_IO_HEADER
+
+/** Completion-driven accept/read loop built directly on io_uring (no
+ *  liburing). Only compiled when building with `make URING=1`.
+ *
+ *  One `io_uring_enter` per loop iteration submits every pending accept and
+ *  read, and waits for at least one completion. The listening socket uses a
+ *  multishot accept so a single submission keeps producing connections, and
+ *  each connection reads into its own slice of a registered buffer pool, so
+ *  the kernel doesn't have to map user pages on every read.
+ */
+
+#define URING_ENTRIES 256   /* Submission queue size */
+#define URING_MAX_CONNS 128 /* Connections being read from at once */
+
+/** Called for every complete request line read from `fd` (the newline is
+ *  kept, and the line is NUL terminated).
+ *
+ *  @returns 1 to keep reading lines from `fd`, or 0 if the callback has taken
+ *           ownership of `fd` (the loop then forgets about it without closing
+ *           it).
+ */
+typedef int (*uring_line_fn)(int fd, char *line, void *arg);
+
+/** Called just before the loop closes a connection it was reading from. */
+typedef void (*uring_close_fn)(int fd, void *arg);
+
+/** @brief Accepts connections on `listenfd` and reads request lines from them
+ *         until they reach EOF, at which point they are closed (after calling
+ *         `on_close`, if it isn't NULL).
+ *
+ *  @returns Only returns (with -1) if io_uring isn't available, in which case
+ *           the caller should fall back to its blocking accept loop.
+ */
+int uring_serve(int listenfd, uring_line_fn on_line, uring_close_fn on_close, void *arg);
+
+#endif
@@ -0,0 +1,48 @@
+#! /usr/bin/env bash
+
+# Sends airport 0, which has a single worker and turns requests away once one
+# is waiting (-w 1), a slow TIME_RANGE followed by a burst of five
+# PLANE_STATUS requests. At most one of them fits in the queue while the
+# TIME_RANGE is being worked out, the rest get BUSY. Once it's done, requests
+# get through again.
+#
+# The airport's node is stopped while the burst is sent, so it all arrives
+# at once when it carries on.
+
+port=$1
+airport_port=$((port + 1))
+controller=`pgrep -o -f "^./controller -p ${port} "`
+node=`pgrep -P ${controller}`
+
+kill -STOP ${node}
+exec 3<>/dev/tcp/localhost/${airport_port}
+echo "TIME_RANGE 0 0 65535 0 47" >&3
+for fd in 4 5 6 7 8; do
+  eval "exec ${fd}<>/dev/tcp/localhost/${airport_port}"
+  echo "PLANE_STATUS 0 1" >&${fd}
+done
+kill -CONT ${node}
+
+head -n 1 <&3
+cat <&3 > /dev/null
+busy=0
+served=0
+for fd in 4 5 6 7 8; do
+  reply=`cat <&${fd}`
+  if [ "${reply}" == "BUSY" ]; then
+    busy=$((busy + 1))
+  elif [ "${reply}" == "PLANE 1 scheduled at GATE 0: 00:00-01:00" ]; then
+    served=$((served + 1))
+  else
+    echo "unexpected: ${reply}"
+  fi
+done
+if [ ${served} -le 1 ] && [ $((busy + served)) -eq 5 ]; then
+  echo "at most one request was queued, the others got BUSY"
+else
+  echo "${served} requests were queued, ${busy} got BUSY"
+fi
+
+exec 9<>/dev/tcp/localhost/${airport_port}
+echo "PLANE_STATUS 0 1" >&9
+cat <&9
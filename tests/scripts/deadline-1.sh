@@ -0,0 +1,31 @@
+#! /usr/bin/env bash
+
+# Queues a PLANE_STATUS with DEADLINE 1 and one with DEADLINE 5000 behind two
+# slow TIME_RANGEs at airport 0, which has a single worker. The first has
+# expired by the time the worker gets to it, the second hasn't.
+#
+# The airport's node is stopped while the requests are sent, so they're all
+# waiting in its listen queue, in order, when it carries on.
+
+port=$1
+airport_port=$((port + 1))
+controller=`pgrep -o -f "^./controller -p ${port} "`
+node=`pgrep -P ${controller}`
+
+kill -STOP ${node}
+exec 3<>/dev/tcp/localhost/${airport_port}
+echo "TIME_RANGE 0 0 65535 0 47" >&3
+exec 4<>/dev/tcp/localhost/${airport_port}
+echo "TIME_RANGE 0 0 65535 0 47" >&4
+exec 5<>/dev/tcp/localhost/${airport_port}
+echo "PLANE_STATUS 0 1 DEADLINE 1" >&5
+exec 6<>/dev/tcp/localhost/${airport_port}
+echo "PLANE_STATUS 0 1 DEADLINE 5000" >&6
+kill -CONT ${node}
+
+for fd in 3 4; do
+  head -n 1 <&${fd}
+  cat <&${fd} > /dev/null
+done
+cat <&5
+cat <&6
@@ -0,0 +1,55 @@
+#! /usr/bin/env bash
+
+# Airport 0 has a single worker, which is kept busy with a TIME_RANGE while
+# more requests queue up behind it:
+#
+# 1. a PLANE_STATUS, a SCHEDULE with plenty of fuel and a low-fuel SCHEDULE
+#    for the same slot. The low-fuel one is served first and gets gate 0, then
+#    the other SCHEDULE, and the PLANE_STATUS, for the low-fuel plane, comes
+#    last and finds it scheduled.
+# 2. a PLANE_STATUS whose connection was accepted (with the TIME_RANGE's) well
+#    over STARVATION_MS ago, and a low-fuel SCHEDULE. The PLANE_STATUS has
+#    waited too long to be put off again, so it goes first and doesn't find
+#    the plane.
+#
+# The airport's node is stopped while the requests are sent, so they're all
+# waiting for it, in order, when it carries on.
+
+port=$1
+airport_port=$((port + 1))
+controller=`pgrep -o -f "^./controller -p ${port} "`
+node=`pgrep -P ${controller}`
+
+# Opens fd on the airport and sends it a request.
+send () {
+  local fd=$1 request=$2
+  eval "exec ${fd}<>/dev/tcp/localhost/${airport_port}"
+  echo "${request}" >&${fd}
+}
+
+kill -STOP ${node}
+send 3 "TIME_RANGE 0 0 8191 0 47"
+send 4 "PLANE_STATUS 0 11"
+send 5 "SCHEDULE 0 10 0 1 40"
+send 6 "SCHEDULE 0 11 0 1 0"
+kill -CONT ${node}
+# whether it went before the others depends on when the worker woke up
+cat <&3 > /dev/null
+for fd in 4 5 6; do
+  cat <&${fd}
+done
+
+# accepted now, their request lines only come later
+exec 3<>/dev/tcp/localhost/${airport_port}
+exec 4<>/dev/tcp/localhost/${airport_port}
+sleep 0.2
+kill -STOP ${node}
+echo "TIME_RANGE 0 0 8191 0 47" >&3
+echo "PLANE_STATUS 0 21" >&4
+send 5 "SCHEDULE 0 21 4 1 0"
+kill -CONT ${node}
+# whether it went before the others depends on when the worker woke up
+cat <&3 > /dev/null
+for fd in 4 5; do
+  cat <&${fd}
+done
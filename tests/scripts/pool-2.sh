@@ -0,0 +1,59 @@
+#! /usr/bin/env bash
+
+# Replies bigger than a worker's reply buffer, served by a pool that grows and
+# shrinks. Airport 0 keeps one worker and may add two more (-j 1-3). DUMP and
+# TIME_RANGE send pieces bigger than the buffer, and TIME_STATUS fills it and
+# has to flush partway through.
+#
+# Each request is sent on its own first, then all of them twice at once, which
+# adds the extra workers, then again after those have idled out, so the
+# workers added the second time reuse the reply buffers the first ones handed
+# back. Every reply has to match the one sent on its own.
+
+port=$1
+outdir=$2
+airport_port=$((port + 1))
+controller=`pgrep -o -f "^./controller -p ${port} "`
+node=`pgrep -P ${controller}`
+requests=("DUMP 0" "TIME_STATUS 0 0 0 46" "TIME_RANGE 0 0 9 0 47")
+
+# the node's threads are its workers plus the one accepting connections
+workers () {
+  echo $((`awk '/^Threads:/ { print $2 }' /proc/${node}/status` - 1))
+}
+
+# the requests before this may have added workers, let them idle out
+for i in $(seq 30); do
+  [ `workers` -eq 1 ] && break
+  sleep 0.1
+done
+
+for i in 0 1 2; do
+  exec 3<>/dev/tcp/localhost/${airport_port}
+  echo "${requests[$i]}" >&3
+  cat <&3 > ${outdir}/alone_${i}
+  exec 3<&-
+  echo "${requests[$i]}: `wc -c < ${outdir}/alone_${i} | tr -d ' '` bytes"
+done
+echo "workers: `workers`"
+
+burst () {
+  kill -STOP ${node}
+  for fd in 3 4 5 6 7 8; do
+    eval "exec ${fd}<>/dev/tcp/localhost/${airport_port}"
+    echo "${requests[$(((fd - 3) % 3))]}" >&${fd}
+  done
+  kill -CONT ${node}
+  differ=0
+  for fd in 3 4 5 6 7 8; do
+    cat <&${fd} > ${outdir}/burst
+    eval "exec ${fd}<&-"
+    cmp -s ${outdir}/burst ${outdir}/alone_$(((fd - 3) % 3)) || differ=$((differ + 1))
+  done
+  echo "workers: `workers`, ${differ} replies differ"
+}
+
+burst
+sleep 2.5
+echo "workers: `workers`"
+burst
@@ -0,0 +1,25 @@
+#! /usr/bin/env bash
+
+# Fetches replies far bigger than one splice() from the controller, and the
+# same replies straight from airport 0's node, and checks the controller relayed
+# them byte for byte (including DUMP's binary records).
+
+port=$1
+outdir=$2
+airport_port=$((port + 1))
+NC_FLAGS="-N"
+
+if [ "$(uname -s)" == "Darwin" ]; then
+  NC_FLAGS=""
+fi
+
+for request in "TIME_RANGE 0 0 5999 0 47" "DUMP 0 BINARY" "DUMP 0"; do
+  echo "${request}" | nc ${NC_FLAGS} localhost ${port} > ${outdir}/relayed
+  echo "${request}" | nc ${NC_FLAGS} localhost ${airport_port} > ${outdir}/direct
+  echo "${request}: `wc -c < ${outdir}/direct | tr -d ' '` bytes"
+  if cmp -s ${outdir}/relayed ${outdir}/direct; then
+    echo "relayed reply matches"
+  else
+    echo "relayed reply differs"
+  fi
+done
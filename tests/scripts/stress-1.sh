@@ -0,0 +1,26 @@
+#! /usr/bin/env bash
+
+# Runs the stress tool against airports 0 and 1 with a fixed seed, four
+# clients sending a hundred requests each, and prints its verdict and exit
+# status. Airport 1 is optimized while the traffic is going on, so its run
+# uses -m. The full reports are kept in the test's output directory.
+
+port=$1
+outdir=$2
+
+./stress -p ${port} -a 0 -c 4 -n 100 -s 7 > ${outdir}/stress_0.out 2>&1
+status=$?
+tail -n 1 ${outdir}/stress_0.out
+echo "stress on airport 0 exited with ${status}"
+
+(
+  for i in $(seq 20); do
+    timeout 5 bash -c "exec 3<>/dev/tcp/localhost/${port}; echo 'OPTIMIZE 1' >&3; head -n 1 <&3 > /dev/null"
+  done
+) &
+optimizer=$!
+./stress -p ${port} -a 1 -c 4 -n 100 -s 7 -m > ${outdir}/stress_1.out 2>&1
+status=$?
+wait ${optimizer}
+tail -n 1 ${outdir}/stress_1.out
+echo "stress on airport 1 exited with ${status}"
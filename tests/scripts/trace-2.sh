@@ -0,0 +1,40 @@
+#! /usr/bin/env bash
+
+# Checks the trace recorded with -T while trace-2's requests were answered,
+# then replays it against a fresh controller and checks that every connection
+# gets back what it got the first time round. The two connections use
+# different airports, so the replay doesn't depend on how they interleave.
+
+port=$1
+outdir=$2
+trace=$outdir/trace.jsonl
+replay_port=$((port + 50))
+replay_args="-p ${replay_port} -R ${outdir}/replay-ready -n 3 -- 3,2,2"
+num_requests=`cat ./tests/inputs/trace-2.input* | wc -l`
+
+# records wait up to TRACE_FLUSH_MS to be written
+while [ "`cat ${trace} 2>/dev/null | wc -l`" -lt ${num_requests} ]; do sleep 0.01; done
+
+# the offsets vary from run to run, but they must be in order
+sed 's/"t_us":[0-9]*/"t_us":T/' ${trace}
+sed 's/^{"t_us":\([0-9]*\),.*/\1/' ${trace} | sort -n -c && echo "records are in time order"
+
+rm -f ${outdir}/replay-ready
+./controller ${replay_args} > ${outdir}/replay_server_out 2>&1 &
+while [ ! -e ${outdir}/replay-ready ]; do sleep 0.01; done
+
+./replay -p ${replay_port} -s max -o ${outdir}/replies ${trace} > ${outdir}/replay_out 2>&1 ||
+  echo "replay failed"
+cat ${outdir}/replies
+# connection n was the n-th request file
+while read -r line; do
+  conn=`echo "$line" | sed 's/^{"conn":\([0-9]*\),.*/\1/'`
+  reply=`echo "$line" | sed 's/^{"conn":[0-9]*,"reply":"\(.*\)"}$/\1/'`
+  if printf '%b' "$reply" | cmp -s - ${outdir}/response$((conn - 1)); then
+    echo "connection ${conn} got the recorded reply"
+  else
+    echo "connection ${conn} got a different reply"
+  fi
+done < ${outdir}/replies
+
+pkill -x -f "./controller ${replay_args}"
@@ -0,0 +1,54 @@
+#! /usr/bin/env bash
+
+# Opens three WATCHes on airport 0 (everything, GATE 1 and PLANE 7), schedules
+# some planes from another connection and prints what each of them streamed.
+# The plane scheduled by watch-2.input comes before any of them, so none of
+# them should see it.
+
+port=$1
+
+# Prints the next n lines from fd, or stops at the first that doesn't come.
+read_lines () {
+  local fd=$1 n=$2 line
+  for i in `seq 1 $n`; do
+    if ! read -r -t 5 -u $fd line; then
+      echo "timed out"
+      return
+    fi
+    echo "$line"
+  done
+}
+
+# Prints any line that arrives on fd within half a second.
+check_quiet () {
+  local fd=$1 line
+  while read -r -t 0.5 -u $fd line; do
+    echo "unexpected: $line"
+  done
+}
+
+exec 3<>/dev/tcp/localhost/$port
+exec 4<>/dev/tcp/localhost/$port
+exec 5<>/dev/tcp/localhost/$port
+echo "WATCH 0" >&3
+echo "WATCH 0 GATE 1" >&4
+echo "WATCH 0 PLANE 7" >&5
+# the subscriptions start once their WATCHING line is sent
+read_lines 3 1
+read_lines 4 1
+read_lines 5 1
+
+exec 6<>/dev/tcp/localhost/$port
+printf "SCHEDULE 0 5 0 2 0\nSCHEDULE 0 6 0 2 0\nSCHEDULE 0 7 4 2 0\nSCHEDULE 0 8 0 2 0\nSCHEDULE 1 7 0 2 0\n" >&6
+read_lines 6 5
+exec 6>&-
+
+echo "-- WATCH 0"
+read_lines 3 3
+check_quiet 3
+echo "-- WATCH 0 GATE 1"
+read_lines 4 1
+check_quiet 4
+echo "-- WATCH 0 PLANE 7"
+read_lines 5 1
+check_quiet 5